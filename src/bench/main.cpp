@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../error.hpp"
+
+namespace xrun {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+auto now_us() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// job side, records when it started and finished
+// argv: --probe FILE DURATION_MS ID:PADDING
+auto run_probe(const char* const file, const char* const duration, const char* const arg) -> int {
+    const auto start = now_us();
+    if(const auto ms = std::atoi(duration); ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+    const auto finish = now_us();
+    const auto id     = std::atol(arg);
+
+    // a single small O_APPEND write is atomic, so jobs can share the file
+    const auto line = std::to_string(id) + " " + std::to_string(start) + " " + std::to_string(finish) + "\n";
+    const auto fd   = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0 || write(fd, line.data(), line.size()) != ssize_t(line.size())) {
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+struct Child {
+    pid_t pid   = -1;
+    int   input = -1; // kept open, xserver and xworker exit when stdin is closed
+};
+
+// pid is -1 if it failed to start
+auto spawn(const std::vector<std::string>& args, const std::string& log, const bool keep_stdin) -> Child {
+    auto argv = std::vector<char*>();
+    for(const auto& a : args) {
+        argv.emplace_back(const_cast<char*>(a.data()));
+    }
+    argv.emplace_back(nullptr);
+
+    auto child = Child();
+    auto input = std::array<int, 2>{-1, -1};
+    auto fa    = posix_spawn_file_actions_t();
+    posix_spawn_file_actions_init(&fa);
+    if(keep_stdin) {
+        if(pipe2(input.data(), O_CLOEXEC) != 0) {
+            warn("pipe2() failed: ", errno);
+            posix_spawn_file_actions_destroy(&fa);
+            return child;
+        }
+        posix_spawn_file_actions_adddup2(&fa, input[0], 0);
+    } else {
+        posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_addopen(&fa, 1, log.data(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    posix_spawn_file_actions_adddup2(&fa, 1, 2);
+    // the bench ignores SIGPIPE, children get it back
+    auto attr = posix_spawnattr_t();
+    auto mask = sigset_t();
+    posix_spawnattr_init(&attr);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+    const auto e = posix_spawn(&child.pid, argv[0], &fa, &attr, argv.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if(keep_stdin) {
+        close(input[0]);
+        child.input = input[1];
+    }
+    if(e != 0) {
+        warn("Failed to spawn ", args[0], ": ", strerror(e));
+        close(child.input);
+        return Child();
+    }
+    return child;
+}
+
+auto write_all(const int fd, const std::string& data) -> bool {
+    auto sent = size_t(0);
+    while(sent < data.size()) {
+        const auto n = write(fd, data.data() + sent, data.size() - sent);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+auto wait_child(const Child& child) -> int {
+    auto status = 0;
+    waitpid(child.pid, &status, 0);
+    return status;
+}
+
+auto kill_child(Child& child) -> void {
+    if(child.pid == -1) {
+        return;
+    }
+    kill(child.pid, SIGKILL);
+    wait_child(child);
+    close(child.input);
+    child.pid = -1;
+}
+
+auto count_lines(const std::string& path) -> size_t {
+    auto file = std::ifstream(path);
+    return std::count(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>(), '\n');
+}
+
+auto wait_for(const auto condition, const std::chrono::seconds timeout) -> bool {
+    const auto limit = Clock::now() + timeout;
+    while(!condition()) {
+        if(Clock::now() > limit) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    return true;
+}
+
+auto log_contains(const std::string& path, const char* const text) -> bool {
+    auto file = std::ifstream(path);
+    auto data = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return data.find(text) != std::string::npos;
+}
+
+struct Record {
+    int64_t start;
+    int64_t finish;
+};
+
+auto read_records(const std::string& path, const size_t count) -> std::vector<Record> {
+    auto file    = std::ifstream(path);
+    auto records = std::vector<Record>(count);
+    auto id      = size_t();
+    auto r       = Record();
+    while(file >> id >> r.start >> r.finish) {
+        if(id < count) {
+            records[id] = r;
+        }
+    }
+    return records;
+}
+
+auto percentile(std::vector<int64_t>& values, const double p) -> double {
+    if(values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    const auto i = std::min(values.size() - 1, size_t(p * values.size()));
+    return values[i] / 1000.0;
+}
+
+struct Config {
+    int jobs;
+    int count;
+    int size;
+    int duration;
+};
+
+struct Programs {
+    std::string xrun;
+    std::string xserver;
+    std::string xworker;
+    std::string self;
+};
+
+auto run_config(const Programs& programs, const Config& config, const std::string& work) -> bool {
+    static auto serial = 0;
+    const auto  name   = "xrun-bench-" + std::to_string(getpid()) + "-" + std::to_string(serial += 1);
+    const auto  dir    = work + "/" + name;
+    std::filesystem::create_directories(dir);
+    const auto worker_log = dir + "/xworker.log";
+    const auto server_log = dir + "/xserver.log";
+    const auto records    = dir + "/records";
+    const auto warmup     = dir + "/warmup";
+
+    // execute the probe directly, the shell is not what we measure
+    auto worker = spawn({programs.xworker, "-l", "-n", name, "-j", std::to_string(config.jobs), "-L", "direct", "-s", "/bin/sh"}, worker_log, true);
+    auto server = Child();
+    auto ok     = false;
+    do {
+        if(worker.pid == -1) {
+            break;
+        }
+        if(!wait_for([&]() { return log_contains(worker_log, "available"); }, std::chrono::seconds(10))) {
+            warn("xworker did not start");
+            break;
+        }
+        server = spawn({programs.xserver, "-n", name}, server_log, true);
+        if(server.pid == -1) {
+            break;
+        }
+        if(!wait_for([&]() { return log_contains(server_log, "Conected to new workers"); }, std::chrono::seconds(10))) {
+            warn("xserver did not connect to xworker");
+            break;
+        }
+
+        // arguments go through stdin, count * size easily exceeds ARG_MAX on the command line
+        // returns the time of the submission, nullopt if xrun failed
+        const auto duration = std::to_string(config.duration);
+        const auto submit   = [&](const std::string& file, const int count) -> std::optional<int64_t> {
+            auto input = std::string();
+            for(auto i = 0; i < count; i += 1) {
+                auto arg = std::to_string(i) + ":";
+                arg.resize(std::max(arg.size(), size_t(config.size)), 'x');
+                input += arg;
+                input += '\n';
+            }
+            const auto begin = now_us();
+            auto       xrun  = spawn({programs.xrun, "-n", name, "-s", programs.self + " --probe " + file + " " + duration}, dir + "/xrun.log", true);
+            if(xrun.pid == -1) {
+                return std::nullopt;
+            }
+            const auto written = write_all(xrun.input, input);
+            close(xrun.input);
+            if(const auto status = wait_child(xrun); !written || status != 0) {
+                warn("xrun failed");
+                return std::nullopt;
+            }
+            return begin;
+        };
+
+        // make sure everything is warm
+        if(!submit(warmup, config.jobs).has_value()) {
+            break;
+        }
+        if(!wait_for([&]() { return count_lines(warmup) == size_t(config.jobs); }, std::chrono::seconds(60))) {
+            warn("Warmup timed out");
+            break;
+        }
+
+        const auto submitted = submit(records, config.count);
+        if(!submitted.has_value()) {
+            break;
+        }
+        const auto begin = *submitted;
+        if(!wait_for([&]() { return count_lines(records) == size_t(config.count); }, std::chrono::seconds(600))) {
+            warn("Jobs timed out");
+            break;
+        }
+
+        auto result      = read_records(records, config.count);
+        auto to_start    = std::vector<int64_t>(); // submit -> start of each job
+        auto starts      = std::vector<int64_t>();
+        auto finishes    = std::vector<int64_t>();
+        auto last_finish = int64_t(0);
+        for(const auto& r : result) {
+            to_start.emplace_back(r.start - begin);
+            starts.emplace_back(r.start);
+            finishes.emplace_back(r.finish);
+            last_finish = std::max(last_finish, r.finish);
+        }
+        // finish -> next start, the k-th start reuses the slot freed by the (k - jobs)-th finish
+        std::sort(starts.begin(), starts.end());
+        std::sort(finishes.begin(), finishes.end());
+        auto gaps = std::vector<int64_t>();
+        for(auto k = size_t(config.jobs); k < starts.size(); k += 1) {
+            gaps.emplace_back(starts[k] - finishes[k - config.jobs]);
+        }
+
+        const auto elapsed = (last_finish - begin) / 1e6;
+        printf("%4d %7d %7d %6d %10.1f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+               config.jobs, config.count, config.size, config.duration, config.count / elapsed,
+               percentile(to_start, 0.5), percentile(to_start, 0.9), percentile(to_start, 0.99),
+               percentile(gaps, 0.5), percentile(gaps, 0.9), percentile(gaps, 0.99));
+        fflush(stdout);
+        ok = true;
+    } while(0);
+
+    kill_child(server);
+    kill_child(worker);
+    if(ok) {
+        std::filesystem::remove_all(dir);
+    } else {
+        // go on with the other configurations
+        warn("Failed with -j ", config.jobs, " count ", config.count, " size ", config.size, " ms ", config.duration, ", logs are left in ", dir);
+    }
+    return ok;
+}
+
+auto parse_list(const char* const str) -> std::vector<int> {
+    auto r = std::vector<int>();
+    for(auto p = str; *p != '\0';) {
+        char* end;
+        r.emplace_back(std::strtol(p, &end, 10));
+        if(end == p) {
+            panic("Invalid list ", str);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return r;
+}
+
+const auto HELP = R"(Usage: xrun-bench [Options] XRUN XSERVER XWORKER
+Measure throughput and dispatch latency of xrun
+Every combination of the lists below is measured with a fresh xserver and xworker.
+Options:
+    -j --jobs LIST       Parallel jobs of xworker (default: 1,4)
+    -c --count LIST      Number of jobs (default: 100,1000)
+    -s --size LIST       Argument size in bytes (default: 16,4096)
+    -d --duration LIST   Run time of each job in milliseconds (default: 0,10)
+    -w --work DIR        Directory for temporary files (default: /tmp)
+    -h --help            Print this help
+)";
+} // namespace
+} // namespace xrun
+
+auto main(const int argc, const char* const argv[]) -> int {
+    if(argc == 5 && std::strcmp(argv[1], "--probe") == 0) {
+        return xrun::run_probe(argv[2], argv[3], argv[4]);
+    }
+    // a failing xrun must not kill the bench while it writes the arguments
+    signal(SIGPIPE, SIG_IGN);
+
+    auto jobs      = std::vector<int>{1, 4};
+    auto counts    = std::vector<int>{100, 1000};
+    auto sizes     = std::vector<int>{16, 4096};
+    auto durations = std::vector<int>{0, 10};
+    auto work      = std::string("/tmp");
+
+    const auto   optstring  = "j:c:s:d:w:h";
+    const option longopts[] = {
+        {"jobs", required_argument, 0, 'j'},
+        {"count", required_argument, 0, 'c'},
+        {"size", required_argument, 0, 's'},
+        {"duration", required_argument, 0, 'd'},
+        {"work", required_argument, 0, 'w'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    int c;
+    while((c = getopt_long(argc, const_cast<char* const*>(argv), optstring, longopts, nullptr)) != -1) {
+        switch(c) {
+        case 'j':
+            jobs = xrun::parse_list(optarg);
+            break;
+        case 'c':
+            counts = xrun::parse_list(optarg);
+            break;
+        case 's':
+            sizes = xrun::parse_list(optarg);
+            break;
+        case 'd':
+            durations = xrun::parse_list(optarg);
+            break;
+        case 'w':
+            work = optarg;
+            break;
+        case 'h':
+            printf("%s\n", xrun::HELP);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+    if(argc - optind != 3) {
+        printf("%s\n", xrun::HELP);
+        return 1;
+    }
+    auto programs = xrun::Programs{
+        .xrun    = std::filesystem::absolute(argv[optind]),
+        .xserver = std::filesystem::absolute(argv[optind + 1]),
+        .xworker = std::filesystem::absolute(argv[optind + 2]),
+        .self    = std::filesystem::read_symlink("/proc/self/exe"),
+    };
+
+    printf("%4s %7s %7s %6s %10s %8s %8s %8s %8s %8s %8s\n", "-j", "count", "argsize", "ms", "jobs/s", "start50", "start90", "start99", "gap50", "gap90", "gap99");
+    printf("%4s %7s %7s %6s %10s %26s %26s\n", "", "", "", "", "", "submit->start (ms)", "finish->next start (ms)");
+    auto failed = false;
+    for(const auto j : jobs) {
+        for(const auto n : counts) {
+            for(const auto s : sizes) {
+                for(const auto d : durations) {
+                    failed |= !xrun::run_config(programs, {j, n, s, d}, work);
+                }
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
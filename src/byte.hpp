@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <optional>
+#include <string_view>
 #include <vector>
 
 namespace {
@@ -24,21 +26,39 @@ class ByteReader {
   public:
     template <class T>
     auto read() -> const T* {
-        if(pos >= lim) {
+        return reinterpret_cast<const T*>(read(sizeof(T)));
+    }
+    auto read(const size_t len) -> const uint8_t* {
+        if(lim - pos < len) {
             return nullptr;
         }
-        pos += sizeof(T);
-        return reinterpret_cast<const T*>(data + pos - sizeof(T));
+        pos += len;
+        return data + pos - len;
     }
     auto read_until(const char c) -> const uint8_t* {
         const auto cptr = &data[pos];
-        for(auto p = pos; p < lim; p += 1) {
-            if(data[p] == c) {
-                pos = p + 1;
-                return cptr;
-            }
+        // memchr compares many bytes at once
+        const auto p = static_cast<const uint8_t*>(std::memchr(cptr, c, lim - pos));
+        if(p == nullptr) {
+            return nullptr;
+        }
+        pos = p - data + 1;
+        return cptr;
+    }
+    // null-terminated string, without the terminator
+    auto read_string() -> std::optional<std::string_view> {
+        const auto begin = pos;
+        const auto str   = read_until('\0');
+        if(str == nullptr) {
+            return std::nullopt;
         }
-        return nullptr;
+        return std::string_view(reinterpret_cast<const char*>(str), pos - begin - 1);
+    }
+    auto is_end() const -> bool {
+        return pos == lim;
+    }
+    auto get_remaining() const -> size_t {
+        return lim - pos;
     }
     ByteReader(const std::vector<uint8_t>& data) : data(data.data()), lim(data.size()){};
     ByteReader(const uint8_t* data, const size_t limit) : data(data), lim(limit) {}
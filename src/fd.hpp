@@ -3,6 +3,7 @@
 #include <optional>
 #include <vector>
 
+#include <fcntl.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 
@@ -21,7 +22,7 @@ class FileDescriptor {
         size_t len = 0;
         while(len < size) {
             const auto n = ::read(fd, (uint8_t*)data + len, size - len);
-            if(n == -1) {
+            if(n <= 0) {
                 return false;
             }
             len += n;
@@ -56,7 +57,7 @@ class FileDescriptor {
     auto write(const void* data, const size_t size) const -> bool {
         size_t wrote = 0;
         while(wrote != size) {
-            const auto r = ::write(fd, data, size);
+            const auto r = ::write(fd, (const uint8_t*)data + wrote, size - wrote);
             if(r == -1) {
                 return false;
             }
@@ -64,6 +65,10 @@ class FileDescriptor {
         }
         return true;
     }
+    auto set_nonblocking() const -> bool {
+        const auto flags = fcntl(fd, F_GETFL);
+        return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+    }
     operator int() const {
         return fd;
     }
@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+#include "byte.hpp"
+#include "fd.hpp"
+#include "wire.hpp"
+
+/*
+    Every packet is framed as
+        uint32_t: payload size, little-endian
+        byte-array: payload
+    the size is fixed width so that it can be filled after the payload is built
+ */
+constexpr auto PACKET_HEADER_SIZE = sizeof(uint32_t);
+// larger payloads are rejected by PacketReader instead of allocating whatever the peer claims
+constexpr auto MAX_PACKET_SIZE = size_t(64 * 1024 * 1024);
+
+// starts a packet at the end of data, returns the position to pass to finish_packet()
+inline auto begin_packet(std::vector<uint8_t>& data) -> size_t {
+    const auto pos = data.size();
+    wire::append_fixed(data, uint32_t(0));
+    return pos;
+}
+// the type is encoded as in wire.hpp
+template <class T>
+auto begin_packet(std::vector<uint8_t>& data, const T type) -> size_t {
+    const auto pos = begin_packet(data);
+    wire::append(data, type);
+    return pos;
+}
+inline auto finish_packet(std::vector<uint8_t>& data, const size_t pos) -> void {
+    wire::write_fixed(&data[pos], uint32_t(data.size() - pos - PACKET_HEADER_SIZE));
+}
+
+class PacketReader {
+  private:
+    constexpr static auto read_size = size_t(64 * 1024);
+
+    std::vector<uint8_t> buffer;
+    size_t               begin     = 0; // first byte not yet parsed
+    size_t               end       = 0; // end of received bytes
+    size_t               checked   = 0; // first header whose size is not yet checked
+    uint64_t             total     = 0; // bytes received so far
+    bool                 oversized = false;
+
+    auto pending_size() const -> size_t {
+        if(end - begin < PACKET_HEADER_SIZE) {
+            return PACKET_HEADER_SIZE;
+        }
+        return PACKET_HEADER_SIZE + wire::read_fixed<uint32_t>(&buffer[begin]);
+    }
+
+  public:
+    // reads as much as available with a single read(), returns false on error, eof or an oversized packet
+    // non-blocking fds without data are not an error
+    // invalidates readers returned by next()
+    auto fill(const FileDescriptor& fd) -> bool {
+        if(oversized) {
+            return false;
+        }
+        if(begin != 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            checked -= begin;
+            begin = 0;
+        }
+        if(const auto required = std::max(pending_size(), end + read_size); buffer.size() < required) {
+            buffer.resize(required);
+        }
+        const auto n = ::read(fd, buffer.data() + end, buffer.size() - end);
+        if(n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        if(n == 0) {
+            return false;
+        }
+        end += n;
+        total += n;
+        // every header is checked once as it arrives, before the buffer grows for its packet
+        while(checked + PACKET_HEADER_SIZE <= end) {
+            const auto size = wire::read_fixed<uint32_t>(&buffer[checked]);
+            if(size > MAX_PACKET_SIZE) {
+                oversized = true;
+                return false;
+            }
+            checked += PACKET_HEADER_SIZE + size;
+        }
+        return true;
+    }
+    // returns the payload of the next complete packet
+    auto next() -> std::optional<ByteReader> {
+        const auto size = pending_size();
+        if(end - begin < size) {
+            return std::nullopt;
+        }
+        const auto payload = &buffer[begin + PACKET_HEADER_SIZE];
+        begin += size;
+        return ByteReader(payload, size - PACKET_HEADER_SIZE);
+    }
+    // blocks until a complete packet arrives
+    auto read(const FileDescriptor& fd) -> std::optional<ByteReader> {
+        while(true) {
+            if(auto r = next(); r.has_value()) {
+                return r;
+            }
+            if(!fill(fd)) {
+                return std::nullopt;
+            }
+        }
+    }
+    auto get_total() const -> uint64_t {
+        return total;
+    }
+    // the peer announced a packet larger than MAX_PACKET_SIZE, the connection should be closed
+    auto is_oversized() const -> bool {
+        return oversized;
+    }
+};
+
+class PacketWriter {
+  private:
+    std::vector<uint8_t> buffer;
+    size_t               sent  = 0;
+    uint64_t             total = 0; // bytes sent so far
+
+  public:
+    // packets are built in place with begin_packet() and finish_packet()
+    auto get_buffer() -> std::vector<uint8_t>& {
+        return buffer;
+    }
+    auto push(const std::vector<uint8_t>& packet) -> void {
+        append_bytes(buffer, packet.data(), packet.size());
+    }
+    // writes until the buffer is empty or the fd would block, returns false on error
+    auto flush(const FileDescriptor& fd) -> bool {
+        while(sent < buffer.size()) {
+            const auto n = ::write(fd, buffer.data() + sent, buffer.size() - sent);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return false;
+            }
+            sent += n;
+            total += n;
+        }
+        if(sent == buffer.size()) {
+            buffer.clear();
+            sent = 0;
+        } else if(sent >= buffer.size() / 2) {
+            buffer.erase(buffer.begin(), buffer.begin() + sent);
+            sent = 0;
+        }
+        return true;
+    }
+    auto is_pending() const -> bool {
+        return !buffer.empty();
+    }
+    auto get_total() const -> uint64_t {
+        return total;
+    }
+};
@@ -1,11 +1,39 @@
 #pragma once
+#include <chrono>
+#include <string>
+
+#include "wire.hpp"
 
 namespace xrun {
-/*
-    Packet xrun to xserver
+// abstract socket names derived from the name given by --name
+// xrun connects to xserver with the first one, xserver connects to the local xworker with the second one
+inline auto server_socket_name(const std::string& name) -> std::string {
+    return std::string(1, '\0') + name;
+}
+inline auto local_worker_socket_name(const std::string& name) -> std::string {
+    return std::string(1, '\0') + name + "-local-worker";
+}
+// xserver writes metrics in Prometheus text format to every connection, then closes it
+// the address is exactly the name, e.g. socat - ABSTRACT-CONNECT:xrun-metrics
+inline auto metrics_socket_name(const std::string& name) -> std::string {
+    return std::string(1, '\0') + name + "-metrics";
+}
+
+// timestamps in the protocol are nanoseconds of the steady clock of the sender
+// xserver estimates the offset between the clocks at the handshake
+inline auto steady_ns() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-    # header
-        size_t: packet size
+// (cwd, command) pairs which xserver registered on a worker group connection, see the job packet
+constexpr auto MAX_TEMPLATES    = uint32_t(1024);
+constexpr auto TEMPLATE_DEFINED = uint32_t(1) << 31;
+
+/*
+    Packets xrun to xserver
+    the first packet starts with a COMMAND, later ones may carry only ARGUMENTs of it
+    xserver enqueues every packet as it arrives, closing the connection ends the submission
+    every packet is framed as in packet.hpp, types are encoded as in wire.hpp
 
     # chunk
         ClientChunkType: chunk type
@@ -14,41 +42,172 @@ namespace xrun {
             null-terminated string: command
         (for ARGUMENT)
             null-terminated string: argument
+        (for INPUT)
+            null-terminated string: absolute path of an input file of the last command
+        (for WAIT)
+            (empty, xrun shuts down its side when the submission ends and waits for the jobs)
+        (for LABEL)
+            null-terminated string: name of the next ARGUMENT for DEPEND
+        (for DEPEND)
+            null-terminated string: label of an earlier ARGUMENT which has to finish before the next ARGUMENT
 
     # chunk...
  */
 enum ClientChunkType {
     COMMAND,
     ARGUMENT,
+    INPUT,
+    WAIT,
+    LABEL,
+    DEPEND,
 };
 
 /*
-    Packet between xserver and xclient
+    Packets xserver to xrun, only if xrun sent WAIT
+    the payload is a ClientMessage and a Progress
 
-    # xclient returns 4 bytes number of workers after receiving WorkerGroupMessage::WORKERS
+    PROGRESS is sent at most every 100ms, FINISHED once all jobs finished and then the connection is closed
+ */
+enum ClientMessage {
+    PROGRESS,
+    FINISHED,
+};
+
+struct Progress {
+    uint64_t received; // jobs received so far
+    uint64_t finished; // including cached and skipped ones
+    uint64_t failed;
+
+    using Layout = wire::Layout<&Progress::received, &Progress::finished, &Progress::failed>;
+};
+
+/*
+    Packets between xserver and xclient
+    every packet is framed as in packet.hpp, the payload is a WorkerGroupMessage and the fields below
+    fields are encoded as in wire.hpp, structs are listed in the order of their Layout
+
+    # workers packet
+        (s -> c)
+            uint32_t: PROTOCOL_VERSION of xserver, fixed width
+        (s <- c)
+            uint32_t: PROTOCOL_VERSION of xclient, fixed width
+            (if the versions are equal)
+                WorkersReply
+        the versions stay fixed width, so that any later version can tell a mismatch
 
     # job packet
-        size_t: packet length
-        null-terminated string: cwd
-        null-terminated string: command
+        (for each job, until the end of the packet)
+            JobEntry
+            (if TEMPLATE_DEFINED is set in the slot)
+                JobTemplate
+            null-terminated string: argument, quoted for the shell
+        the command line is the command of the template, a space and the argument
+        a template is sent once per connection and kept in its slot until the slot is reused
+        slots are reused in order, so both sides agree on them without further messages
+
+    # done packet
+        std::vector<DoneEntry>
+
+    # output packet
+        OutputHeader
+        byte-array: output, until the end of the packet
+
+    # credit packet
+        uint64_t: bytes of output xclient may send in addition
+        (xclient streams output only after receiving a credit packet)
+
+    # capacity packet
+        uint32_t: number of slots xclient is going to use
+        (xclient may use fewer slots than it has while the host is busy)
+
+    # revoke packet
+        uint32_t: maximum number of queued jobs to give back
+
+    # ids packet
+        std::vector<uint64_t>: ids of the jobs given back for REVOKE
 
     # error packet
-        size_t: command length
-        byte-array: command
-        1 byte: exitted
-        (for exitted == 1)
-            1 byte: exit code
-        (for exitted == 0)
-            1 byte: signal number
-        size_t: stdout length
-        byte-array: stdout
-        size_t: stderr length
-        byte-array: stderr
+        ErrorPacket
  */
 enum class WorkerGroupMessage {
-    WORKERS, // s <-  c : none :
-    DONE,    // s <-  c : : none
-    ERROR,   // s <-  c : : error packet
-    JOB,     // s  -> c : job packet :
+    WORKERS,  // s <-> c : workers packet : workers packet
+    DONE,     // s <-  c : : done packet
+    ERROR,    // s <-  c : : error packet
+    JOB,      // s  -> c : job packet :
+    REVOKE,   // s  -> c : revoke packet :
+    REVOKED,  // s <-  c : : ids packet
+    OUTPUT,   // s <-  c : : output packet
+    CREDIT,   // s  -> c : credit packet :
+    CAPACITY, // s <-  c : : capacity packet
+};
+
+// 1 was the format with native-endian fixed width fields
+constexpr auto PROTOCOL_VERSION = uint32_t(2);
+
+struct WorkersReply {
+    uint32_t workers;
+    int64_t  timestamp; // of the reply
+
+    using Layout = wire::Layout<&WorkersReply::workers, &WorkersReply::timestamp>;
+};
+
+struct JobEntry {
+    uint64_t id;
+    uint32_t slot; // of the template
+
+    using Layout = wire::Layout<&JobEntry::id, &JobEntry::slot>;
+};
+
+struct JobTemplate {
+    std::string cwd;
+    std::string command; // without the argument
+
+    using Layout = wire::Layout<&JobTemplate::cwd, &JobTemplate::command>;
+};
+
+// for jobs run by a zygote, only cpu time and page faults are filled; max_rss and context switches are 0
+struct DoneEntry {
+    uint64_t id;
+    uint32_t slot; // which ran the job
+    int64_t  started;
+    int64_t  finished;
+    int64_t  user_us;
+    int64_t  system_us;
+    int64_t  max_rss_kb;
+    int64_t  minor_faults;
+    int64_t  major_faults;
+    int64_t  voluntary_switches;
+    int64_t  involuntary_switches;
+
+    using Layout = wire::Layout<&DoneEntry::id, &DoneEntry::slot, &DoneEntry::started, &DoneEntry::finished,
+                                &DoneEntry::user_us, &DoneEntry::system_us, &DoneEntry::max_rss_kb, &DoneEntry::minor_faults,
+                                &DoneEntry::major_faults, &DoneEntry::voluntary_switches, &DoneEntry::involuntary_switches>;
+};
+
+struct OutputHeader {
+    uint64_t id;
+    uint8_t  stream; // 1 for stdout, 2 for stderr
+
+    using Layout = wire::Layout<&OutputHeader::id, &OutputHeader::stream>;
+};
+
+struct CapturedOutput {
+    uint64_t    total; // length of the whole output
+    std::string head;
+    std::string tail; // follows the head without overlap
+    std::string log;  // path to the full output on the worker, empty if not saved
+
+    using Layout = wire::Layout<&CapturedOutput::total, &CapturedOutput::head, &CapturedOutput::tail, &CapturedOutput::log>;
+};
+
+struct ErrorPacket {
+    uint64_t       id;
+    std::string    command;
+    bool           exitted;
+    uint8_t        code; // exit code if exitted, signal number otherwise
+    CapturedOutput out;
+    CapturedOutput err;
+
+    using Layout = wire::Layout<&ErrorPacket::id, &ErrorPacket::command, &ErrorPacket::exitted, &ErrorPacket::code, &ErrorPacket::out, &ErrorPacket::err>;
 };
 } // namespace xrun
@@ -1,3 +1,5 @@
+#include <cstddef>
+
 #include <ifaddrs.h>
 #include <netinet/ip.h>
 #include <sys/socket.h>
@@ -8,8 +10,8 @@
 
 namespace xrun {
 namespace {
-auto create_socket(const int type) -> OpenSocketResult {
-    const auto fd = socket(type, SOCK_STREAM, 0);
+auto create_socket(const int type, const int flags = 0) -> OpenSocketResult {
+    const auto fd = socket(type, SOCK_STREAM | flags, 0);
     if(fd < 0) {
         return {-1, "socket() failed", errno};
     } else {
@@ -19,10 +21,12 @@ auto create_socket(const int type) -> OpenSocketResult {
 auto create_local_socket() -> OpenSocketResult {
     return create_socket(AF_UNIX);
 }
-auto create_tcp_socket() -> OpenSocketResult {
-    return create_socket(AF_INET);
+auto create_tcp_socket(const int flags = 0) -> OpenSocketResult {
+    return create_socket(AF_INET, flags);
 }
-auto create_sockaddr_un(const char* const path) -> sockaddr_un {
+// addrlen is set to the exact length of the address
+// an abstract name is not terminated, so other clients connect with just the name and no padding
+auto create_sockaddr_un(const char* const path, socklen_t& addrlen) -> sockaddr_un {
     auto addr = sockaddr_un();
     memset(&addr, 0, sizeof(sockaddr_un));
     addr.sun_family = AF_UNIX;
@@ -31,6 +35,7 @@ auto create_sockaddr_un(const char* const path) -> sockaddr_un {
     // path[0] may be '\0'
     const auto len = strlen(&path[1]) + 1;
     memcpy(addr.sun_path, path, len);
+    addrlen = offsetof(sockaddr_un, sun_path) + len + (path[0] == '\0' ? 0 : 1);
 
     return addr;
 }
@@ -41,9 +46,10 @@ auto open_local_server_socket(const char* const path) -> OpenSocketResult {
         return result;
     }
 
-    auto addr = create_sockaddr_un(path);
+    auto addrlen = socklen_t();
+    auto addr    = create_sockaddr_un(path, addrlen);
 
-    if(bind(result.fd, (sockaddr*)&addr, sizeof(sockaddr_un)) < 0) {
+    if(bind(result.fd, (sockaddr*)&addr, addrlen) < 0) {
         return {-1, "bind() failed", errno};
     }
     if(listen(result.fd, 2) < 0) {
@@ -58,9 +64,10 @@ auto open_local_client_socket(const char* const path) -> OpenSocketResult {
         return result;
     }
 
-    auto addr = create_sockaddr_un(path);
+    auto addrlen = socklen_t();
+    auto addr    = create_sockaddr_un(path, addrlen);
 
-    if(connect(result.fd, (sockaddr*)&addr, sizeof(sockaddr_un)) < 0) {
+    if(connect(result.fd, (sockaddr*)&addr, addrlen) < 0) {
         return {-1, "connect() failed", errno};
     } else {
         return result;
@@ -92,16 +99,24 @@ auto open_tcp_server_socket(const std::array<uint16_t, 2> port, uint16_t* const
     }
 }
 auto open_tcp_client_socket(const uint32_t address, const uint16_t port) -> OpenSocketResult {
-    auto result = create_tcp_socket();
+    auto result = create_tcp_socket(SOCK_NONBLOCK);
     if(result.message != nullptr) {
         return result;
     }
     auto addr = sockaddr_in{.sin_family = AF_INET, .sin_port = htons(port), .sin_addr = {address}};
-    if(connect(result.fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    if(connect(result.fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
         return {-1, "connect() failed", errno};
     }
     return result;
 }
+auto get_socket_error(const int fd) -> int {
+    auto error = 0;
+    auto len   = static_cast<socklen_t>(sizeof(error));
+    if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        return errno;
+    }
+    return error;
+}
 auto get_self_address() -> std::vector<uint32_t> {
     ifaddrs* ifaddr;
     if(getifaddrs(&ifaddr) == -1) {
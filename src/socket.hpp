@@ -18,7 +18,10 @@ struct OpenSocketResult {
 auto open_local_server_socket(const char* name) -> OpenSocketResult;
 auto open_local_client_socket(const char* name) -> OpenSocketResult;
 auto open_tcp_server_socket(const std::array<uint16_t, 2> port, uint16_t* selected = nullptr) -> OpenSocketResult;
+// non-blocking, the socket becomes writable when the connection is established or failed
 auto open_tcp_client_socket(uint32_t address, uint16_t port) -> OpenSocketResult;
+// pending error of the socket, tells the result of a non-blocking connect
+auto get_socket_error(int fd) -> int;
 
 auto get_self_address() -> std::vector<uint32_t>;
 
@@ -0,0 +1,214 @@
+#pragma once
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "byte.hpp"
+
+/*
+    Encoding of packet contents, independent of the host
+        unsigned integer, enum: LEB128 varint
+        signed integer: zigzag, then varint
+        bool: 1 byte
+        std::string: varint length, bytes
+        std::vector: varint count, elements
+        struct with a Layout: fields in the order of the layout
+    fixed width integers are little-endian, for fields written before their value is known
+ */
+namespace wire {
+inline auto append_varint(std::vector<uint8_t>& data, uint64_t value) -> void {
+    while(value >= 0x80) {
+        data.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+inline auto read_varint(ByteReader& reader) -> std::optional<uint64_t> {
+    auto value = uint64_t(0);
+    for(auto shift = 0; shift < 64; shift += 7) {
+        const auto byte = reader.read<uint8_t>();
+        if(byte == nullptr) {
+            return std::nullopt;
+        }
+        value |= uint64_t(*byte & 0x7f) << shift;
+        if(!(*byte & 0x80)) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+template <std::unsigned_integral T>
+auto write_fixed(uint8_t* const dest, const T value) -> void {
+    for(auto i = size_t(0); i < sizeof(T); i += 1) {
+        dest[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+}
+template <std::unsigned_integral T>
+auto read_fixed(const uint8_t* const src) -> T {
+    auto value = T(0);
+    for(auto i = size_t(0); i < sizeof(T); i += 1) {
+        value |= T(src[i]) << (i * 8);
+    }
+    return value;
+}
+template <std::unsigned_integral T>
+auto append_fixed(std::vector<uint8_t>& data, const T value) -> void {
+    data.resize(data.size() + sizeof(T));
+    write_fixed(&data[data.size() - sizeof(T)], value);
+}
+
+template <class T>
+struct Codec;
+
+template <class T>
+    requires std::unsigned_integral<T> && (!std::same_as<T, bool>)
+struct Codec<T> {
+    static auto append(std::vector<uint8_t>& data, const T value) -> void {
+        append_varint(data, value);
+    }
+    static auto read(ByteReader& reader, T& value) -> bool {
+        const auto v = read_varint(reader);
+        if(!v.has_value() || *v > std::numeric_limits<T>::max()) {
+            return false;
+        }
+        value = static_cast<T>(*v);
+        return true;
+    }
+};
+
+template <std::signed_integral T>
+struct Codec<T> {
+    using Unsigned = std::make_unsigned_t<T>;
+
+    static auto append(std::vector<uint8_t>& data, const T value) -> void {
+        // small magnitudes of either sign stay short
+        append_varint(data, (Unsigned(value) << 1) ^ Unsigned(value >> (sizeof(T) * 8 - 1)));
+    }
+    static auto read(ByteReader& reader, T& value) -> bool {
+        auto u = Unsigned();
+        if(!Codec<Unsigned>::read(reader, u)) {
+            return false;
+        }
+        value = static_cast<T>((u >> 1) ^ -(u & 1));
+        return true;
+    }
+};
+
+template <class T>
+    requires std::is_enum_v<T>
+struct Codec<T> {
+    using Underlying = std::make_unsigned_t<std::underlying_type_t<T>>;
+
+    static auto append(std::vector<uint8_t>& data, const T value) -> void {
+        Codec<Underlying>::append(data, static_cast<Underlying>(value));
+    }
+    static auto read(ByteReader& reader, T& value) -> bool {
+        auto u = Underlying();
+        if(!Codec<Underlying>::read(reader, u)) {
+            return false;
+        }
+        value = static_cast<T>(u);
+        return true;
+    }
+};
+
+template <>
+struct Codec<bool> {
+    static auto append(std::vector<uint8_t>& data, const bool value) -> void {
+        data.push_back(value ? 1 : 0);
+    }
+    static auto read(ByteReader& reader, bool& value) -> bool {
+        const auto byte = reader.read<uint8_t>();
+        if(byte == nullptr || *byte > 1) {
+            return false;
+        }
+        value = *byte != 0;
+        return true;
+    }
+};
+
+template <>
+struct Codec<std::string> {
+    static auto append(std::vector<uint8_t>& data, const std::string& value) -> void {
+        append_varint(data, value.size());
+        append_bytes(data, value.data(), value.size());
+    }
+    static auto read(ByteReader& reader, std::string& value) -> bool {
+        const auto size = read_varint(reader);
+        const auto data = size.has_value() ? reader.read(*size) : nullptr;
+        if(data == nullptr) {
+            return false;
+        }
+        value.assign(reinterpret_cast<const char*>(data), *size);
+        return true;
+    }
+};
+
+template <class T>
+struct Codec<std::vector<T>> {
+    static auto append(std::vector<uint8_t>& data, const std::vector<T>& value) -> void {
+        append_varint(data, value.size());
+        for(const auto& e : value) {
+            Codec<T>::append(data, e);
+        }
+    }
+    static auto read(ByteReader& reader, std::vector<T>& value) -> bool {
+        const auto count = read_varint(reader);
+        // every element takes at least a byte, do not trust the count for the allocation
+        if(!count.has_value() || *count > reader.get_remaining()) {
+            return false;
+        }
+        value.resize(*count);
+        for(auto& e : value) {
+            if(!Codec<T>::read(reader, e)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <class T>
+    requires requires { typename T::Layout; }
+struct Codec<T> {
+    static auto append(std::vector<uint8_t>& data, const T& value) -> void {
+        T::Layout::append(data, value);
+    }
+    static auto read(ByteReader& reader, T& value) -> bool {
+        return T::Layout::read(reader, value);
+    }
+};
+
+template <class C, class M>
+auto member_type(M C::*) -> M;
+
+// describes a message by pointers to its members, generates both directions
+template <auto... members>
+struct Layout {
+    template <class T>
+    static auto append(std::vector<uint8_t>& data, const T& value) -> void {
+        (Codec<decltype(member_type(members))>::append(data, value.*members), ...);
+    }
+    template <class T>
+    static auto read(ByteReader& reader, T& value) -> bool {
+        return (Codec<decltype(member_type(members))>::read(reader, value.*members) && ...);
+    }
+};
+
+template <class T>
+auto append(std::vector<uint8_t>& data, const T& value) -> void {
+    Codec<T>::append(data, value);
+}
+template <class T>
+auto read(ByteReader& reader) -> std::optional<T> {
+    auto value = T();
+    if(!Codec<T>::read(reader, value)) {
+        return std::nullopt;
+    }
+    return value;
+}
+} // namespace wire
@@ -0,0 +1,65 @@
+#include <filesystem>
+
+#include <getopt.h>
+
+#include "arg.hpp"
+
+namespace xrun {
+auto parse_args(const int argc, const char* const argv[]) -> Args {
+    int  help   = 0;
+    auto result = Args();
+
+    // stop at the command, options of the command are not ours
+    const auto   optstring  = "+i:n:s0gwh";
+    const option longopts[] = {
+        {"input", required_argument, 0, 'i'},
+        {"name", required_argument, 0, 'n'},
+        {"stdin", no_argument, 0, 's'},
+        {"null", no_argument, 0, '0'},
+        {"graph", no_argument, 0, 'g'},
+        {"wait", no_argument, 0, 'w'},
+        {"help", no_argument, &help, 1},
+        {0, 0, 0, 0},
+    };
+
+    int longindex = 0;
+    int c;
+    while((c = getopt_long(argc, const_cast<char* const*>(argv), optstring, longopts, &longindex)) != -1) {
+        switch(c) {
+        case 'i':
+            // xserver may run in another directory
+            result.inputs.emplace_back(std::filesystem::absolute(optarg));
+            break;
+        case 'n':
+            result.name = optarg;
+            break;
+        case 's':
+            result.stdin_delimiter = '\n';
+            break;
+        case '0':
+            result.stdin_delimiter = '\0';
+            break;
+        case 'g':
+            result.graph = true;
+            if(!result.stdin_delimiter.has_value()) {
+                result.stdin_delimiter = '\n';
+            }
+            break;
+        case 'w':
+            result.wait = true;
+            break;
+        case 'h':
+            help = 1;
+            break;
+        }
+    }
+    if(optind < argc) {
+        result.command = argv[optind];
+        result.arguments.assign(argv + optind + 1, argv + argc);
+    }
+
+    result.help = help != 0;
+
+    return result;
+}
+} // namespace xrun
@@ -0,0 +1,19 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace xrun {
+struct Args {
+    std::vector<std::string> inputs;
+    std::string              name    = "xrun";
+    const char*              command = nullptr;
+    std::vector<const char*> arguments;
+    std::optional<char>      stdin_delimiter; // read more arguments from stdin
+    bool                     graph = false;   // arguments from stdin have labels and dependencies
+    bool                     wait  = false;
+    bool                     help  = false;
+};
+
+auto parse_args(int argc, const char* const argv[]) -> Args;
+} // namespace xrun
@@ -1,47 +1,226 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include "../byte.hpp"
 #include "../error.hpp"
+#include "../packet.hpp"
 #include "../protocol.hpp"
 #include "../socket.hpp"
+#include "arg.hpp"
 
 namespace xrun {
 namespace {
-auto build_stream(const int argc, const char* const argv[]) -> std::vector<uint8_t> {
-    auto res = std::vector<uint8_t>();
-    append_bytes(res, ClientChunkType::COMMAND);
-    const auto cwd = std::filesystem::current_path();
+auto append_argument(std::vector<uint8_t>& data, const char* const arg, const size_t len) -> void {
+    wire::append(data, ClientChunkType::ARGUMENT);
+    append_bytes(data, arg, len);
+    append_bytes(data, '\0');
+}
+auto build_stream(const Args& args) -> std::vector<uint8_t> {
+    auto       res    = std::vector<uint8_t>();
+    const auto packet = begin_packet(res, ClientChunkType::COMMAND);
+    const auto cwd    = std::filesystem::current_path();
     append_bytes(res, cwd.c_str(), std::strlen(cwd.c_str()) + 1);
-    append_bytes(res, argv[1], std::strlen(argv[1]) + 1);
+    append_bytes(res, args.command, std::strlen(args.command) + 1);
 
-    for(auto i = 2; i < argc; i += 1) {
-        append_bytes(res, ClientChunkType::ARGUMENT);
-        append_bytes(res, argv[i], std::strlen(argv[i]) + 1);
+    for(const auto& input : args.inputs) {
+        wire::append(res, ClientChunkType::INPUT);
+        append_bytes(res, input.data(), input.size() + 1);
+    }
+    if(args.wait) {
+        wire::append(res, ClientChunkType::WAIT);
+    }
+    for(const auto arg : args.arguments) {
+        append_argument(res, arg, std::strlen(arg));
+    }
+    finish_packet(res, packet);
+    if(res.size() - packet - PACKET_HEADER_SIZE > MAX_PACKET_SIZE) {
+        panic("Arguments exceed ", MAX_PACKET_SIZE, " bytes, pass them through --stdin");
     }
 
     return res;
 }
+// "LABEL: DEPENDENCY...: ARG", label and dependencies are separated by spaces and may be empty
+auto append_graph_line(std::vector<uint8_t>& data, const std::string_view line) -> void {
+    const auto first  = line.find(':');
+    const auto second = first == std::string_view::npos ? first : line.find(':', first + 1);
+    if(second == std::string_view::npos) {
+        panic("Invalid line, expected \"LABEL: DEPENDENCY...: ARG\": ", line);
+    }
+    const auto append_words = [&data](std::string_view words, const ClientChunkType type) {
+        while(!words.empty()) {
+            const auto begin = words.find_first_not_of(' ');
+            if(begin == std::string_view::npos) {
+                break;
+            }
+            words.remove_prefix(begin);
+            const auto word = words.substr(0, words.find(' '));
+            wire::append(data, type);
+            append_bytes(data, word.data(), word.size());
+            append_bytes(data, '\0');
+            words.remove_prefix(word.size());
+        }
+    };
+    append_words(line.substr(0, first), ClientChunkType::LABEL);
+    append_words(line.substr(first + 1, second - first - 1), ClientChunkType::DEPEND);
+    auto arg = line.substr(second + 1);
+    arg.remove_prefix(std::min(arg.find_first_not_of(' '), arg.size()));
+    append_argument(data, arg.data(), arg.size());
+}
+// sends arguments read from stdin, a packet for each read so that xserver starts the first jobs early
+auto stream_stdin(const FileDescriptor& fd, const char delimiter, const bool graph) -> void {
+    const auto append_item = [graph](std::vector<uint8_t>& data, const char* const item, const size_t len) {
+        if(graph) {
+            append_graph_line(data, std::string_view(item, len));
+        } else {
+            append_argument(data, item, len);
+        }
+    };
+
+    constexpr auto read_size = size_t(64 * 1024);
+
+    auto buffer  = std::vector<char>(read_size);
+    auto pending = size_t(0); // incomplete argument at the beginning of buffer
+    auto data    = std::vector<uint8_t>();
+    while(true) {
+        if(buffer.size() - pending < read_size) {
+            buffer.resize(pending + read_size);
+        }
+        const auto n = read(STDIN_FILENO, buffer.data() + pending, read_size);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            panic("Failed to read stdin: ", errno);
+        }
+        const auto eof = n == 0;
+        const auto end = pending + n;
+
+        data.clear();
+        const auto packet = begin_packet(data);
+        auto       begin  = size_t(0);
+        while(true) {
+            const auto p = static_cast<const char*>(std::memchr(buffer.data() + begin, delimiter, end - begin));
+            if(p == nullptr) {
+                break;
+            }
+            const auto len = size_t(p - (buffer.data() + begin));
+            if(len != 0) {
+                append_item(data, buffer.data() + begin, len);
+            }
+            begin += len + 1;
+        }
+        if(eof && begin < end) {
+            append_item(data, buffer.data() + begin, end - begin);
+            begin = end;
+        }
+        std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+        pending = end - begin;
+
+        if(data.size() > PACKET_HEADER_SIZE) {
+            finish_packet(data, packet);
+            if(data.size() - PACKET_HEADER_SIZE > MAX_PACKET_SIZE) {
+                panic("Argument exceeds ", MAX_PACKET_SIZE, " bytes");
+            }
+            if(!fd.write(data.data(), data.size())) {
+                panic("Failed to write stream: ", errno);
+            }
+        }
+        if(eof) {
+            break;
+        }
+    }
+}
+// returns the exit code, non-zero if any job failed
+auto wait_jobs(const FileDescriptor& fd) -> int {
+    // xserver takes eof as the end of the submission
+    if(shutdown(fd, SHUT_WR) < 0) {
+        panic("shutdown() failed: ", errno);
+    }
+    const auto show   = isatty(STDERR_FILENO) == 1;
+    auto       shown  = false;
+    auto       reader = PacketReader();
+    while(true) {
+        auto packet = reader.read(fd);
+        if(!packet.has_value()) {
+            if(shown) {
+                fprintf(stderr, "\n");
+            }
+            panic("Lost connection to xserver");
+        }
+        const auto type     = wire::read<ClientMessage>(*packet);
+        const auto progress = wire::read<Progress>(*packet);
+        if(!type.has_value() || !progress.has_value()) {
+            panic("Failed to parse progress packet");
+        }
+        if(show) {
+            fprintf(stderr, "\r%" PRIu64 "/%" PRIu64 " jobs finished, %" PRIu64 " failed", progress->finished, progress->received, progress->failed);
+            shown = true;
+        }
+        if(*type != ClientMessage::FINISHED) {
+            continue;
+        }
+        if(shown) {
+            fprintf(stderr, "\n");
+        }
+        if(progress->failed != 0) {
+            warn(progress->failed, " of ", progress->received, " jobs failed");
+            return 1;
+        }
+        return 0;
+    }
+}
 } // namespace
-auto run(const int argc, const char* const argv[]) -> void {
-    if(argc <= 1) {
+auto run(const Args& args) -> int {
+    if(args.command == nullptr) {
         panic("Too few arguments");
     }
     auto fd = FileDescriptor(-1);
-    if(auto r = open_local_client_socket("\0xrun"); r.message != nullptr) {
+    if(auto r = open_local_client_socket(server_socket_name(args.name).data()); r.message != nullptr) {
         panic("Failed to connect to xserver: ", r.message);
     } else {
         fd = r.fd;
     }
-    const auto   data = xrun::build_stream(argc, argv);
-    const size_t size = data.size();
-    if(!fd.write(size) || !fd.write(data.data(), size)) {
+    const auto data = xrun::build_stream(args);
+    if(!fd.write(data.data(), data.size())) {
         panic("Failed to write stream: ", errno);
     }
+    if(args.stdin_delimiter.has_value()) {
+        stream_stdin(fd, *args.stdin_delimiter, args.graph);
+    }
+    return args.wait ? wait_jobs(fd) : 0;
 }
 } // namespace xrun
 
+const static auto HELP =
+    R"(Usage: xrun [Options] COMMAND ARGS...
+Run "COMMAND ARG" for each ARG on xserver
+Options:
+    -i --input FILE  The result depends on FILE, for the cache of xserver
+                     You can add multiple files by repeating this option.
+    -n --name NAME   Name of the socket of xserver (default: xrun)
+    -s --stdin       Read more ARGS from stdin, one per line
+                     They are streamed, xserver starts jobs before stdin ends.
+    -0 --null        Like --stdin, but ARGS are separated by NUL
+    -g --graph       Like --stdin, but each line is "LABEL: DEPENDENCY...: ARG"
+                     The job starts when the jobs of the listed labels have
+                     succeeded, they must be on earlier lines. Labels may be
+                     empty. Jobs whose dependencies failed are skipped.
+    -w --wait        Wait until all jobs finish, showing the progress on a terminal
+                     Exits with 1 if any job failed.
+    -h --help        Print this help
+)";
+
 auto main(const int argc, const char* const argv[]) -> int {
-    xrun::run(argc, argv);
-    return 0;
+    const auto args = xrun::parse_args(argc, argv);
+    if(args.help) {
+        printf("%s\n", HELP);
+        return 0;
+    }
+    return xrun::run(args);
 } // namespace xrun
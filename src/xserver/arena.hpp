@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+namespace xrun {
+// reference counted pointer without atomic operations, xserver has only one thread
+template <class T>
+class Rc {
+  private:
+    struct Box {
+        T        value;
+        uint32_t refs;
+    };
+
+    Box* box = nullptr;
+
+    auto release() -> void {
+        if(box != nullptr && (box->refs -= 1) == 0) {
+            delete box;
+        }
+        box = nullptr;
+    }
+
+  public:
+    template <class... Args>
+    static auto make(Args&&... args) -> Rc {
+        auto r = Rc();
+        r.box  = new Box{T(std::forward<Args>(args)...), 1};
+        return r;
+    }
+    auto get() const -> T* {
+        return box != nullptr ? &box->value : nullptr;
+    }
+    auto operator*() const -> T& {
+        return box->value;
+    }
+    auto operator->() const -> T* {
+        return &box->value;
+    }
+    auto operator==(std::nullptr_t) const -> bool {
+        return box == nullptr;
+    }
+    auto operator=(const Rc& o) -> Rc& {
+        if(o.box != nullptr) {
+            o.box->refs += 1;
+        }
+        release();
+        box = o.box;
+        return *this;
+    }
+    auto operator=(Rc&& o) -> Rc& {
+        if(this != &o) {
+            release();
+            box = std::exchange(o.box, nullptr);
+        }
+        return *this;
+    }
+
+    Rc() = default;
+    Rc(const Rc& o) : box(o.box) {
+        if(box != nullptr) {
+            box->refs += 1;
+        }
+    }
+    Rc(Rc&& o) : box(std::exchange(o.box, nullptr)) {}
+    ~Rc() {
+        release();
+    }
+};
+
+// fixed size, so that stored strings never move
+struct StringBlock {
+    std::unique_ptr<char[]> data;
+    uint32_t                size = 0;
+    uint32_t                capacity;
+
+    StringBlock(const uint32_t capacity) : data(new char[capacity]), capacity(capacity) {}
+};
+
+// null-terminated string in a block, the block lives while any of its strings does
+class ArenaString {
+  private:
+    Rc<StringBlock> block;
+    uint32_t        offset = 0;
+    uint32_t        length = 0;
+
+  public:
+    auto view() const -> std::string_view {
+        return block == nullptr ? std::string_view() : std::string_view(block->data.get() + offset, length);
+    }
+    auto empty() const -> bool {
+        return length == 0;
+    }
+
+    ArenaString() = default;
+    ArenaString(Rc<StringBlock> block, const uint32_t offset, const uint32_t length) : block(std::move(block)), offset(offset), length(length) {}
+};
+
+// packs the arguments of received jobs together instead of allocating each of them
+class StringArena {
+  private:
+    constexpr static auto block_size = uint32_t(256 * 1024);
+
+    Rc<StringBlock> current;
+
+  public:
+    auto store(const std::string_view str) -> ArenaString {
+        const auto required = uint32_t(str.size() + 1);
+        if(current == nullptr || current->capacity - current->size < required) {
+            // a long string gets its own block, the current one keeps its free space
+            if(required > block_size / 4) {
+                auto block = Rc<StringBlock>::make(required);
+                std::memcpy(block->data.get(), str.data(), str.size());
+                block->data[str.size()] = '\0';
+                block->size             = required;
+                return ArenaString(std::move(block), 0, str.size());
+            }
+            current = Rc<StringBlock>::make(block_size);
+        }
+        const auto offset = current->size;
+        std::memcpy(current->data.get() + offset, str.data(), str.size());
+        current->data[offset + str.size()] = '\0';
+        current->size += required;
+        return ArenaString(current, offset, str.size());
+    }
+};
+} // namespace xrun
@@ -4,12 +4,22 @@
 
 namespace xrun {
 auto parse_args(const int argc, const char* const argv[]) -> Args {
-    int  help = 0;
+    int  stream = 0, tag = 0, help = 0;
     auto result = Args();
 
-    const auto   optstring  = "r:h";
+    const auto   optstring  = "r:p:stw:c:T:H:l:o:n:h";
     const option longopts[] = {
         {"remote", required_argument, 0, 'r'},
+        {"prefetch", required_argument, 0, 'p'},
+        {"stream", no_argument, &stream, 1},
+        {"tag", no_argument, &tag, 1},
+        {"window", required_argument, 0, 'w'},
+        {"cache", required_argument, 0, 'c'},
+        {"trace", required_argument, 0, 'T'},
+        {"history", required_argument, 0, 'H'},
+        {"locality", required_argument, 0, 'l'},
+        {"timeout", required_argument, 0, 'o'},
+        {"name", required_argument, 0, 'n'},
         {"help", required_argument, &help, 1},
         {0, 0, 0, 0},
     };
@@ -21,12 +31,44 @@ auto parse_args(const int argc, const char* const argv[]) -> Args {
         case 'r':
             result.remotes.emplace_back(optarg);
             break;
+        case 'p':
+            result.prefetch = std::stoul(optarg);
+            break;
+        case 's':
+            stream = 1;
+            break;
+        case 't':
+            tag = 1;
+            break;
+        case 'w':
+            result.window = std::stoull(optarg);
+            break;
+        case 'c':
+            result.cache = optarg;
+            break;
+        case 'T':
+            result.trace = optarg;
+            break;
+        case 'H':
+            result.history = optarg;
+            break;
+        case 'l':
+            result.locality = std::stoll(optarg);
+            break;
+        case 'o':
+            result.timeout = std::stoul(optarg);
+            break;
+        case 'n':
+            result.name = optarg;
+            break;
         case 'h':
             help = 1;
             break;
         }
     }
 
+    result.stream = stream != 0;
+    result.tag    = tag != 0;
     result.help   = help != 0;
 
     return result;
@@ -1,11 +1,22 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace xrun {
 struct Args {
     std::vector<std::string> remotes;
-    bool                     help = false;
+    uint32_t                 prefetch = 0;
+    bool                     stream   = false;
+    bool                     tag      = false;
+    uint64_t                 window   = 1024 * 1024;
+    const char*              cache    = nullptr;
+    const char*              trace    = nullptr;
+    const char*              history  = nullptr;
+    int64_t                  locality = -1;
+    uint32_t                 timeout  = 10; // seconds, 0 disables
+    std::string              name     = "xrun";
+    bool                     help     = false;
 };
 auto parse_args(int argc, const char* const argv[]) -> Args;
 } // namespace xrun
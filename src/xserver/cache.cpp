@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <filesystem>
+
+#include <fcntl.h>
+
+#include "../byte.hpp"
+#include "../error.hpp"
+#include "../fd.hpp"
+#include "cache.hpp"
+#include "hash.hpp"
+
+namespace xrun {
+namespace {
+auto read_file(const char* const path, std::string& data) -> bool {
+    const auto fd = FileDescriptor(open(path, O_RDONLY | O_CLOEXEC));
+    if(fd < 0) {
+        return false;
+    }
+    while(true) {
+        char       buf[64 * 1024];
+        const auto n = read(fd, buf, sizeof(buf));
+        if(n < 0) {
+            return false;
+        }
+        if(n == 0) {
+            return true;
+        }
+        data.append(buf, n);
+    }
+}
+auto append_string(std::vector<uint8_t>& buffer, const std::string_view str) -> void {
+    append_bytes(buffer, str.size());
+    append_bytes(buffer, str.data(), str.size());
+}
+auto read_string(ByteReader& reader, std::string& str) -> bool {
+    const auto size = reader.read<size_t>();
+    if(size == nullptr) {
+        return false;
+    }
+    const auto data = reader.read(*size);
+    if(data == nullptr) {
+        return false;
+    }
+    str.assign(reinterpret_cast<const char*>(data), *size);
+    return true;
+}
+} // namespace
+auto ResultCache::get_path(const uint64_t key) const -> std::string {
+    char name[17];
+    snprintf(name, sizeof(name), "%016lx", key);
+    return dir + "/" + name;
+}
+// entries also store what they were computed from to detect collisions
+auto ResultCache::compute_key(const Job& job) const -> std::optional<uint64_t> {
+    auto& command = *job.get_command();
+
+    // every argument of the command shares the inputs, read them only for the first one
+    if(!command.inputs.empty() && !command.input_digest.has_value()) {
+        auto hasher = Hasher();
+        auto data   = std::string();
+        for(const auto& input : command.inputs) {
+            data.clear();
+            if(!read_file(input.data(), data)) {
+                return std::nullopt;
+            }
+            hasher.update(input);
+            hasher.update(data);
+        }
+        command.input_digest = hasher.get();
+    }
+
+    auto hasher = Hasher();
+    hasher.update(command.cwd);
+    hasher.update(command.command);
+    hasher.update(job.get_arg());
+    if(command.input_digest.has_value()) {
+        const auto digest = *command.input_digest;
+        hasher.update(&digest, sizeof(digest));
+    }
+    return hasher.get();
+}
+auto ResultCache::load(const uint64_t key, const Job& job) const -> std::optional<CacheEntry> {
+    auto data = std::string();
+    if(!read_file(get_path(key).data(), data)) {
+        return std::nullopt;
+    }
+    auto reader = ByteReader(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    auto cwd = std::string(), command = std::string(), arg = std::string();
+    auto entry = CacheEntry();
+    if(!read_string(reader, cwd) || !read_string(reader, command) || !read_string(reader, arg) || !read_string(reader, entry.out) || !read_string(reader, entry.err)) {
+        warn("Broken cache entry ", get_path(key));
+        return std::nullopt;
+    }
+    // entries written before the flag existed count as not captured
+    if(const auto captured = reader.read<uint8_t>(); captured != nullptr) {
+        entry.captured = *captured != 0;
+    }
+    if(cwd != job.get_command()->cwd || command != job.get_command()->command || arg != job.get_arg()) {
+        // hash collision
+        return std::nullopt;
+    }
+    return entry;
+}
+auto ResultCache::store(const uint64_t key, const Job& job, const CacheEntry& entry) const -> bool {
+    auto data = std::vector<uint8_t>();
+    append_string(data, job.get_command()->cwd);
+    append_string(data, job.get_command()->command);
+    append_string(data, job.get_arg());
+    append_string(data, entry.out);
+    append_string(data, entry.err);
+    append_bytes(data, static_cast<uint8_t>(entry.captured ? 1 : 0));
+
+    // write to a temporary file and rename, so that readers never see a partial entry
+    const auto path = get_path(key);
+    const auto temp = path + ".tmp";
+    {
+        const auto fd = FileDescriptor(open(temp.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if(fd < 0 || !fd.write(data.data(), data.size())) {
+            return false;
+        }
+    }
+    auto error = std::error_code();
+    std::filesystem::rename(temp, path, error);
+    return !error;
+}
+ResultCache::ResultCache(std::string dir) : dir(std::move(dir)) {
+    auto error = std::error_code();
+    std::filesystem::create_directories(this->dir, error);
+    if(error) {
+        panic("Failed to create cache directory ", this->dir, ": ", error.message());
+    }
+}
+} // namespace xrun
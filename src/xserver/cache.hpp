@@ -0,0 +1,31 @@
+#pragma once
+#include <optional>
+#include <string>
+
+#include "worker.hpp"
+
+namespace xrun {
+// output of a successful job, only streamed output is known to xserver
+struct CacheEntry {
+    std::string out;
+    std::string err;
+    bool        captured = false; // stored while streaming, otherwise the output is unknown
+};
+
+// results of successful jobs, stored in a directory as one file per key
+class ResultCache {
+  private:
+    std::string dir;
+
+    auto get_path(uint64_t key) const -> std::string;
+
+  public:
+    // hashes cwd, command, argument and the contents of the input files, which are read once per command
+    // returns nullopt if an input file could not be read
+    auto compute_key(const Job& job) const -> std::optional<uint64_t>;
+    auto load(uint64_t key, const Job& job) const -> std::optional<CacheEntry>;
+    auto store(uint64_t key, const Job& job, const CacheEntry& entry) const -> bool;
+
+    ResultCache(std::string dir);
+};
+} // namespace xrun
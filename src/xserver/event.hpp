@@ -0,0 +1,17 @@
+#pragma once
+
+namespace xrun {
+// epoll_event.data.ptr of the server points to one of these
+enum class EventSourceType {
+    STDIN,
+    LISTENER,
+    CLIENT,
+    WORKER_GROUP,
+    METRICS,
+    METRICS_CLIENT,
+};
+
+struct EventSource {
+    EventSourceType source_type;
+};
+} // namespace xrun
@@ -0,0 +1,75 @@
+#include "../error.hpp"
+#include "graph.hpp"
+
+namespace xrun {
+auto DependencyGraph::add(const std::string& label, const std::vector<std::string>& dependencies) -> uint32_t {
+    const auto index = uint32_t(nodes.size());
+    auto&      node  = nodes.emplace_back();
+    unfinished += 1;
+    for(const auto& dependency : dependencies) {
+        const auto p = labels.find(dependency);
+        if(p == labels.end()) {
+            warn("Unknown dependency \"", dependency, "\", jobs can only depend on jobs sent before them");
+            continue;
+        }
+        auto& parent = nodes[p->second];
+        if(parent.finished) {
+            node.failed |= parent.failed;
+            continue;
+        }
+        parent.dependents.push_back(index);
+        node.waiting += 1;
+    }
+    if(!label.empty()) {
+        if(labels.contains(label)) {
+            warn("Duplicate label \"", label, "\", later dependencies refer to the last one");
+        }
+        labels[label] = index;
+    }
+    return index;
+}
+auto DependencyGraph::hold(Job& job) -> DependencyState {
+    auto& node = nodes[*job.get_node()];
+    if(node.failed) {
+        return DependencyState::FAILED;
+    }
+    if(node.waiting == 0) {
+        return DependencyState::READY;
+    }
+    node.job.emplace(std::move(job));
+    return DependencyState::WAITING;
+}
+auto DependencyGraph::finish(const uint32_t index, const bool failed, std::vector<Job>& ready, std::vector<Job>& skipped) -> void {
+    auto& node = nodes[index];
+    if(node.finished) {
+        return;
+    }
+    node.finished = true;
+    node.failed   = failed;
+    unfinished -= 1;
+    for(const auto d : node.dependents) {
+        auto& dependent = nodes[d];
+        // not held: already skipped because of another dependency
+        if(!dependent.job.has_value()) {
+            dependent.failed |= failed;
+            continue;
+        }
+        dependent.waiting -= 1;
+        if(failed) {
+            dependent.failed = true;
+            skipped.emplace_back(std::move(*dependent.job));
+        } else if(dependent.waiting == 0) {
+            ready.emplace_back(std::move(*dependent.job));
+        } else {
+            continue;
+        }
+        dependent.job.reset();
+    }
+}
+auto DependencyGraph::set_ended() -> void {
+    ended = true;
+}
+auto DependencyGraph::is_done() const -> bool {
+    return ended && unfinished == 0;
+}
+} // namespace xrun
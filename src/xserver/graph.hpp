@@ -0,0 +1,43 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "worker.hpp"
+
+namespace xrun {
+enum class DependencyState {
+    READY,   // every dependency finished
+    WAITING, // the job is held by the graph
+    FAILED,  // a dependency failed, the job must not run
+};
+
+// jobs of a submission which wait for other jobs of it
+// a job can only depend on labels sent before it, so there are no cycles
+class DependencyGraph {
+  private:
+    struct Node {
+        std::vector<uint32_t> dependents;
+        std::optional<Job>    job;              // held while waiting
+        uint32_t              waiting  = 0;     // unfinished dependencies
+        bool                  finished = false; // by itself or by a failed dependency
+        bool                  failed   = false;
+    };
+
+    std::unordered_map<std::string, uint32_t> labels;
+    std::vector<Node>                         nodes;
+    uint32_t                                  unfinished = 0;
+    bool                                      ended      = false; // no more jobs are coming
+
+  public:
+    // returns the node of the next job, label may be empty
+    auto add(const std::string& label, const std::vector<std::string>& dependencies) -> uint32_t;
+    // takes job if it has to wait
+    auto hold(Job& job) -> DependencyState;
+    // ready: jobs whose last dependency was this, skipped: held jobs which must not run anymore
+    auto finish(uint32_t node, bool failed, std::vector<Job>& ready, std::vector<Job>& skipped) -> void;
+    auto set_ended() -> void;
+    auto is_done() const -> bool;
+};
+} // namespace xrun
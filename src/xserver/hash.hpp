@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+namespace xrun {
+// 64-bit FNV-1a, users store what they hashed if collisions matter
+class Hasher {
+  private:
+    uint64_t hash = 0xcbf29ce484222325;
+
+  public:
+    auto update(const void* const data, const size_t len) -> void {
+        const auto bytes = static_cast<const uint8_t*>(data);
+        for(auto i = size_t(0); i < len; i += 1) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3;
+        }
+    }
+    auto update(const std::string_view str) -> void {
+        // include a terminator so that ("ab", "c") and ("a", "bc") differ
+        const auto terminator = '\0';
+        update(str.data(), str.size());
+        update(&terminator, 1);
+    }
+    auto get() const -> uint64_t {
+        return hash;
+    }
+};
+} // namespace xrun
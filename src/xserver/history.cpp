@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+
+#include "../error.hpp"
+#include "hash.hpp"
+#include "history.hpp"
+
+namespace xrun {
+namespace {
+auto command_key(const Job& job) -> uint64_t {
+    auto hasher = Hasher();
+    hasher.update(job.get_command()->command);
+    return hasher.get();
+}
+auto job_key(const Job& job) -> uint64_t {
+    auto hasher = Hasher();
+    hasher.update(job.get_command()->command);
+    hasher.update(job.get_arg());
+    return hasher.get();
+}
+auto format_line(const uint64_t key, const double seconds, const uint32_t samples) -> std::string {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%016" PRIx64 " %.6f %" PRIu32 "\n", key, seconds, samples);
+    return buf;
+}
+} // namespace
+auto RuntimeHistory::update(const uint64_t key, const double seconds) -> void {
+    auto& e = estimates.try_emplace(key, Estimate{seconds, 0}).first->second;
+    // plain average for the first samples, then follow recent runs
+    const auto weight = std::max(1.0 / (e.samples + 1), 0.2);
+    e.seconds += (seconds - e.seconds) * weight;
+    e.samples += 1;
+    const auto line = format_line(key, e.seconds, e.samples);
+    log.write(line.data(), line.size());
+}
+auto RuntimeHistory::estimate(const Job& job) const -> std::optional<double> {
+    for(const auto key : {job_key(job), command_key(job)}) {
+        if(const auto p = estimates.find(key); p != estimates.end()) {
+            return p->second.seconds;
+        }
+    }
+    return std::nullopt;
+}
+auto RuntimeHistory::record(const Job& job, const double seconds) -> void {
+    update(job_key(job), seconds);
+    update(command_key(job), seconds);
+}
+auto RuntimeHistory::flush() -> void {
+    log.flush();
+}
+RuntimeHistory::RuntimeHistory(std::string path) : path(std::move(path)) {
+    // the last line of a key is the latest
+    if(auto file = std::ifstream(this->path); file) {
+        auto line = std::string();
+        while(std::getline(file, line)) {
+            auto key     = uint64_t();
+            auto seconds = double();
+            auto samples = uint32_t();
+            if(sscanf(line.data(), "%" SCNx64 " %lf %" SCNu32, &key, &seconds, &samples) == 3) {
+                estimates[key] = {seconds, samples};
+            }
+        }
+    }
+
+    // compact, then append to it
+    const auto temp = this->path + ".tmp";
+    {
+        auto file = std::ofstream(temp);
+        for(const auto& [key, e] : estimates) {
+            file << format_line(key, e.seconds, e.samples);
+        }
+        if(!file) {
+            panic("Failed to write history file ", temp);
+        }
+    }
+    auto error = std::error_code();
+    std::filesystem::rename(temp, this->path, error);
+    if(error) {
+        panic("Failed to write history file ", this->path, ": ", error.message());
+    }
+    log.open(this->path, std::ios::app);
+    print("Loaded ", estimates.size(), " runtime estimates");
+}
+} // namespace xrun
@@ -0,0 +1,32 @@
+#pragma once
+#include <fstream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "worker.hpp"
+
+namespace xrun {
+// observed runtimes of jobs, kept in a file across runs
+// estimates are kept per command and argument, and per command for unseen arguments
+class RuntimeHistory {
+  private:
+    struct Estimate {
+        double   seconds;
+        uint32_t samples;
+    };
+
+    std::string                            path;
+    std::ofstream                          log; // updates are appended, compacted on startup
+    std::unordered_map<uint64_t, Estimate> estimates;
+
+    auto update(uint64_t key, double seconds) -> void;
+
+  public:
+    auto estimate(const Job& job) const -> std::optional<double>;
+    auto record(const Job& job, double seconds) -> void;
+    auto flush() -> void;
+
+    RuntimeHistory(std::string path);
+};
+} // namespace xrun
@@ -4,9 +4,36 @@
 const static auto HELP =
     R"(Usage: xserver
 Options:
-    -r --remote IP  Remote server (e.g.: 192.168.11.1)
-                    You can add multiple servers by repeating this option.
-    -h --help       Print this help
+    -r --remote IP     Remote server (e.g.: 192.168.11.1)
+                       You can add multiple servers by repeating this option.
+    -p --prefetch N    Queue N extra jobs on each worker group
+                       Hides network latency between jobs on remote workers.
+    -s --stream        Print output of jobs while they are running
+    -t --tag           Same as --stream, but prefix each line with the argument
+    -w --window N      Bytes of output each worker group may send ahead
+                       Workers stop reading output until it is printed.
+                       (default: 1048576)
+    -c --cache DIR     Cache results of successful jobs in DIR
+                       Jobs with the same cwd, command, argument and input files
+                       (see xrun -i) are not run again.
+    -T --trace FILE    Write a timeline of jobs to FILE
+                       Open it with Perfetto or chrome://tracing.
+    -H --history FILE  Run the longest jobs of each submission first
+                       Runtimes of jobs are remembered in FILE. Jobs never seen
+                       take the runtime of the same command, or run first if
+                       the command is new too.
+    -l --locality N    Send jobs to the worker group which recently ran jobs
+                       in the same directory or its parent, if they wait
+                       behind at most N more jobs there than on the best group
+                       Keeps page caches and network filesystem caches warm.
+    -o --timeout SEC   Give up a remote worker group which does not connect and
+                       reply within SEC seconds, 0 waits forever. Groups are
+                       connected in parallel and take jobs as soon as each of
+                       them replies.
+                       (default: 10)
+    -n --name NAME     Name of the sockets to run multiple instances
+                       (default: xrun)
+    -h --help          Print this help
 )";
 
 int main(const int argc, const char* const argv[]) {
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "metrics.hpp"
+
+namespace xrun {
+auto Histogram::observe(const double value) -> void {
+    auto i = size_t(0);
+    while(i < bounds.size() && value > bounds[i]) {
+        i += 1;
+    }
+    counts[i] += 1;
+    sum += value;
+}
+auto Histogram::render(std::string& out, const char* const name, const char* const help) const -> void {
+    render_header(out, name, "histogram", help);
+    const auto bucket = std::string(name) + "_bucket";
+    auto       total  = uint64_t(0);
+    for(auto i = size_t(0); i <= bounds.size(); i += 1) {
+        total += counts[i];
+        char labels[32];
+        if(i < bounds.size()) {
+            snprintf(labels, sizeof(labels), "le=\"%g\"", bounds[i]);
+        } else {
+            snprintf(labels, sizeof(labels), "le=\"+Inf\"");
+        }
+        render_value(out, bucket.data(), labels, total);
+    }
+    render_value(out, (std::string(name) + "_sum").data(), nullptr, sum);
+    render_value(out, (std::string(name) + "_count").data(), nullptr, total);
+}
+
+auto Usage::add(const Usage& o) -> void {
+    jobs += o.jobs;
+    wall += o.wall;
+    user += o.user;
+    system += o.system;
+    max_rss_kb = std::max(max_rss_kb, o.max_rss_kb);
+    minor_faults += o.minor_faults;
+    major_faults += o.major_faults;
+    voluntary_switches += o.voluntary_switches;
+    involuntary_switches += o.involuntary_switches;
+}
+
+auto render_header(std::string& out, const char* const name, const char* const type, const char* const help) -> void {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+auto render_value(std::string& out, const char* const name, const char* const labels, const double value) -> void {
+    char buf[64];
+    snprintf(buf, sizeof(buf), " %.17g\n", value);
+    out += name;
+    if(labels != nullptr) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += buf;
+}
+auto render_counter(std::string& out, const char* const name, const char* const help, const uint64_t value) -> void {
+    render_header(out, name, "counter", help);
+    render_value(out, name, nullptr, value);
+}
+auto render_gauge(std::string& out, const char* const name, const char* const help, const double value) -> void {
+    render_header(out, name, "gauge", help);
+    render_value(out, name, nullptr, value);
+}
+} // namespace xrun
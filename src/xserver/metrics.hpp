@@ -0,0 +1,59 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace xrun {
+// non-cumulative counts, so that observe() touches a single bucket
+class Histogram {
+  private:
+    constexpr static auto bounds = std::array{0.001, 0.01, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0, 60.0, 300.0, 1800.0, 3600.0};
+
+    std::array<uint64_t, bounds.size() + 1> counts = {};
+    double                                  sum    = 0;
+
+  public:
+    auto observe(double value) -> void;
+    auto render(std::string& out, const char* name, const char* help) const -> void;
+};
+
+// resources consumed by jobs, see the done packet
+struct Usage {
+    uint64_t jobs                 = 0;
+    double   wall                 = 0; // seconds
+    double   user                 = 0;
+    double   system               = 0;
+    int64_t  max_rss_kb           = 0; // largest of the jobs
+    int64_t  minor_faults         = 0;
+    int64_t  major_faults         = 0;
+    int64_t  voluntary_switches   = 0;
+    int64_t  involuntary_switches = 0;
+
+    auto add(const Usage& o) -> void;
+};
+
+// everything is updated on the dispatch path, keep them plain integers
+struct Metrics {
+    uint64_t  jobs_received       = 0;
+    uint64_t  jobs_dispatched     = 0;
+    uint64_t  jobs_completed      = 0;
+    uint64_t  jobs_failed         = 0;
+    uint64_t  jobs_requeued       = 0;
+    uint64_t  jobs_cached         = 0;
+    uint64_t  jobs_placed_locally = 0;
+    uint64_t  jobs_skipped        = 0;
+    uint64_t  bytes_sent          = 0; // of closed worker groups, connected ones are added on render
+    uint64_t  bytes_received      = 0;
+    Histogram job_duration; // from dispatch to the done report
+
+    std::unordered_map<std::string, Usage> usage_by_command;
+    std::unordered_map<std::string, Usage> usage_by_group; // by address, survives reconnections
+};
+
+// Prometheus text exposition format
+auto render_header(std::string& out, const char* name, const char* type, const char* help) -> void;
+auto render_value(std::string& out, const char* name, const char* labels, double value) -> void;
+auto render_counter(std::string& out, const char* name, const char* help, uint64_t value) -> void;
+auto render_gauge(std::string& out, const char* name, const char* help, double value) -> void;
+} // namespace xrun
@@ -0,0 +1,54 @@
+#include <algorithm>
+
+#include "../error.hpp"
+#include "queue.hpp"
+
+namespace xrun {
+auto JobQueue::push(const uint64_t submission, std::vector<Job> jobs) -> void {
+    if(jobs.empty()) {
+        return;
+    }
+    count += jobs.size();
+    const auto first = std::make_move_iterator(jobs.begin()), last = std::make_move_iterator(jobs.end());
+    if(const auto s = std::find_if(submissions.begin(), submissions.end(), [submission](const Submission& s) { return s.id == submission; }); s != submissions.end()) {
+        s->jobs.insert(s->jobs.end(), first, last);
+        return;
+    }
+    // insert just before the cursor, so that the new submission is served last in the current round
+    const auto s = submissions.emplace(cursor, Submission{submission, std::deque<Job>(first, last)});
+    if(cursor == submissions.end()) {
+        cursor = s;
+    }
+}
+auto JobQueue::requeue(Job job) -> void {
+    returned.emplace_back(std::move(job));
+    count += 1;
+}
+auto JobQueue::pop() -> Job {
+    ASSERT(!empty(), "Pop from empty queue")
+    if(!returned.empty()) {
+        auto job = std::move(returned.front());
+        returned.pop_front();
+        count -= 1;
+        return job;
+    }
+    auto job = std::move(cursor->jobs.front());
+    cursor->jobs.pop_front();
+    count -= 1;
+    if(cursor->jobs.empty()) {
+        cursor = submissions.erase(cursor);
+    } else {
+        cursor = std::next(cursor);
+    }
+    if(cursor == submissions.end()) {
+        cursor = submissions.begin();
+    }
+    return job;
+}
+auto JobQueue::empty() const -> bool {
+    return count == 0;
+}
+auto JobQueue::size() const -> size_t {
+    return count;
+}
+} // namespace xrun
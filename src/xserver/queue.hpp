@@ -0,0 +1,30 @@
+#pragma once
+#include <deque>
+#include <list>
+#include <vector>
+
+#include "worker.hpp"
+
+namespace xrun {
+// pending jobs, shared round-robin between submissions
+class JobQueue {
+  private:
+    struct Submission {
+        uint64_t        id;
+        std::deque<Job> jobs;
+    };
+
+    std::deque<Job>                 returned; // revoked jobs, served first
+    std::list<Submission>           submissions;
+    std::list<Submission>::iterator cursor = submissions.end();
+    size_t                          count  = 0;
+
+  public:
+    // jobs of the same submission id share a turn, a streaming xrun pushes many times with its id
+    auto push(uint64_t submission, std::vector<Job> jobs) -> void;
+    auto requeue(Job job) -> void;
+    auto pop() -> Job;
+    auto empty() const -> bool;
+    auto size() const -> size_t;
+};
+} // namespace xrun
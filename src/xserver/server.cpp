@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <optional>
+#include <string_view>
 
 #include <arpa/inet.h>
 #include <sys/epoll.h>
@@ -8,6 +14,7 @@
 #include "../byte.hpp"
 #include "../error.hpp"
 #include "../fd.hpp"
+#include "../packet.hpp"
 #include "../protocol.hpp"
 #include "server.hpp"
 #include "worker.hpp"
@@ -34,95 +41,197 @@ auto parse_str_to_address(const std::string& str) -> std::optional<std::pair<uin
     }
     return std::make_pair(number.s_addr, port_n);
 }
-auto escape_argument(const char* const arg) -> std::string {
-    auto res = std::string();
-    res += '\'';
-    const char* c = arg;
-    while(*c != '\0') {
-        if(*c == '\'') {
-            res += "\\\'";
-        } else {
-            res += *c;
+// quotes for sh, a quote inside becomes '\''
+auto append_escaped(std::vector<uint8_t>& buffer, const std::string_view arg) -> void {
+    append_bytes(buffer, '\'');
+    auto rest = arg;
+    while(true) {
+        const auto q = static_cast<const char*>(std::memchr(rest.data(), '\'', rest.size()));
+        if(q == nullptr) {
+            break;
         }
-        c += 1;
+        const auto len = size_t(q - rest.data());
+        append_bytes(buffer, rest.data(), len);
+        append_bytes(buffer, "'\\''", 4);
+        rest.remove_prefix(len + 1);
     }
-    res += '\'';
-    return res;
+    append_bytes(buffer, rest.data(), rest.size());
+    append_bytes(buffer, '\'');
 }
 } // namespace
 namespace xrun {
 namespace {
-auto build_job_packet(const std::string& cwd, const std::string& command, const std::string& arg) -> std::vector<uint8_t> {
-    auto r = std::vector<uint8_t>();
-
-    const auto escaped = escape_argument(arg.data());
-    const auto header  = sizeof(WorkerGroupMessage) + sizeof(size_t);
-    const auto data    = cwd.size() + 1 + command.size() + 1 + escaped.size() + 1;
-    r.reserve(header + data);
-
-    append_bytes(r, WorkerGroupMessage::JOB);
-    append_bytes(r, static_cast<size_t>(data));
-    append_bytes(r, cwd.data(), cwd.size() + 1);
-    append_bytes(r, command.data(), command.size());
-    append_bytes(r, ' ');
-    append_bytes(r, escaped.data(), escaped.size() + 1);
-
-    return r;
+// the command is sent only the first time on the connection
+auto append_job(std::vector<uint8_t>& buffer, const uint64_t id, const std::pair<uint32_t, bool> slot, const Command& command, const std::string_view arg) -> void {
+    wire::append(buffer, JobEntry{id, slot.second ? slot.first | TEMPLATE_DEFINED : slot.first});
+    if(slot.second) {
+        wire::append(buffer, JobTemplate{command.cwd, command.command});
+    }
+    append_escaped(buffer, arg);
+    append_bytes(buffer, '\0');
+}
+auto get_group_name(const WorkerGroup& g) -> std::string {
+    return g.get_address() == 0 ? "local" : inet_ntoa({g.get_address()});
 }
-struct ErrorPacket {
-    std::string command;
-    std::string out;
-    std::string err;
-    bool        exitted;
-    char        code;
+struct Done {
+    uint64_t id;
+    uint32_t slot;
+    int64_t  started;
+    int64_t  finished;
+    Usage    usage;
 };
-auto parse_error_packet(const FileDescriptor& fd) -> ErrorPacket {
-    do {
-        auto       r        = ErrorPacket();
-        const auto cmd_size = fd.read<size_t>();
-        if(!cmd_size.has_value()) {
-            break;
+auto read_done_packet(ByteReader& packet) -> std::vector<Done> {
+    const auto entries = wire::read<std::vector<DoneEntry>>(packet);
+    if(!entries.has_value()) {
+        panic("Failed to parse done packet");
+    }
+    auto r = std::vector<Done>();
+    r.reserve(entries->size());
+    for(const auto& e : *entries) {
+        auto& done                      = r.emplace_back(Done{e.id, e.slot, e.started, e.finished});
+        done.usage.jobs                 = 1;
+        done.usage.wall                 = (e.finished - e.started) / 1e9;
+        done.usage.user                 = e.user_us / 1e6;
+        done.usage.system               = e.system_us / 1e6;
+        done.usage.max_rss_kb           = e.max_rss_kb;
+        done.usage.minor_faults         = e.minor_faults;
+        done.usage.major_faults         = e.major_faults;
+        done.usage.voluntary_switches   = e.voluntary_switches;
+        done.usage.involuntary_switches = e.involuntary_switches;
+    }
+    return r;
+}
+auto format_output(const CapturedOutput& output) -> std::string {
+    auto       r       = output.head;
+    const auto omitted = output.total - output.head.size() - output.tail.size();
+    if(omitted != 0) {
+        r += "\n... " + std::to_string(omitted) + " bytes omitted ...\n";
+    }
+    r += output.tail;
+    if(!output.log.empty()) {
+        r += "\n(full output: " + output.log + ")";
+    }
+    return r;
+}
+// "/a/b" -> "/a" -> "", also "" for relative paths
+auto parent_dir(const std::string_view dir) -> std::string_view {
+    const auto p = dir.rfind('/');
+    return p == std::string_view::npos ? std::string_view() : dir.substr(0, p);
+}
+// averages per job, cpu/wall above 100% means the jobs use more than their slot
+auto format_usage(const Usage& usage) -> std::string {
+    const auto n = std::max<double>(usage.jobs, 1);
+    char       buf[256];
+    snprintf(buf, sizeof(buf), "%6lu jobs  wall %8.3fs  cpu %8.3fs (%4.0f%%)  max rss %8ld KiB  faults %8.0f/%6.0f  switches %8.0f/%6.0f",
+             usage.jobs, usage.wall / n, (usage.user + usage.system) / n, usage.wall > 0 ? (usage.user + usage.system) * 100 / usage.wall : 0,
+             usage.max_rss_kb, usage.minor_faults / n, usage.major_faults / n, usage.voluntary_switches / n, usage.involuntary_switches / n);
+    return buf;
+}
+// prefixes each complete line with the tag, like "parallel --tag"
+auto write_tagged(std::ostream& out, const std::string& tag, std::string& partial, const char* const data, const size_t len) -> void {
+    partial.append(data, len);
+    auto pos = size_t(0);
+    for(auto end = partial.find('\n'); end != std::string::npos; end = partial.find('\n', pos)) {
+        out << tag << '\t';
+        out.write(partial.data() + pos, end + 1 - pos);
+        pos = end + 1;
+    }
+    partial.erase(0, pos);
+    out.flush();
+}
+} // namespace
+auto Server::find_free_group() -> WorkerGroup* {
+    // fill idle workers first, then prefetch queues
+    auto r = (WorkerGroup*)nullptr;
+    for(auto& w : worker_groups) {
+        if(w.is_idle()) {
+            return &w;
         }
-        r.command.resize(*cmd_size);
-        if(!fd.read(r.command.data(), *cmd_size)) {
-            break;
+        if(r == nullptr && !w.is_busy()) {
+            r = &w;
         }
-
-        const auto exitted = fd.read<uint8_t>();
-        if(!exitted.has_value()) {
-            break;
+    }
+    return r;
+}
+auto Server::dispatch_job(WorkerGroup& g, Job job, const TimePoint now) -> void {
+    auto&       buffer = g.get_writer().get_buffer();
+    const auto& cwd    = job.get_command()->cwd;
+    const auto  arg    = job.get_arg();
+    const auto  id     = next_job_id;
+    append_job(buffer, id, g.intern_command(job.get_command()->id), *job.get_command(), arg);
+    print("[", jobs.size(), "] \"", cwd, "\" \"", arg, '"');
+    job.set_dispatched(now);
+    g.push_job(id, std::move(job));
+    next_job_id += 1;
+}
+auto Server::find_recent_group(const std::string& cwd) -> WorkerGroup* {
+    // the same directory or the deepest ancestor which ran a job wins, "/" is not considered
+    for(auto dir = std::string_view(cwd); dir.size() > 1; dir = parent_dir(dir)) {
+        const auto p = recent_groups.find(dir);
+        if(p == recent_groups.end()) {
+            continue;
         }
-        r.exitted       = *exitted != 0;
-        const auto code = fd.read<uint8_t>();
-        if(!code.has_value()) {
-            break;
+        for(auto& g : worker_groups) {
+            if(g.get_serial() == p->second && !g.is_closed()) {
+                return &g;
+            }
         }
-        r.code = *code;
+    }
+    return nullptr;
+}
+auto Server::remember_group(const std::string& cwd, const WorkerGroup& g) -> void {
+    recent_groups[cwd] = g.get_serial();
+}
+auto Server::assign_jobs_by_locality() -> void {
+    // jobs which have to finish before a new job starts on the group
+    const auto jobs_ahead = [](const WorkerGroup& g) -> int64_t {
+        return g.get_busy() < g.get_capacity() ? 0 : g.get_busy() - g.get_capacity() + 1;
+    };
 
-        const auto out_size = fd.read<size_t>();
-        if(!out_size.has_value()) {
+    // every group chosen gets a single packet
+    struct Pending {
+        WorkerGroup* group;
+        size_t       packet;
+        uint32_t     count;
+    };
+    auto       pending = std::vector<Pending>();
+    const auto now     = std::chrono::steady_clock::now();
+    while(!jobs.empty()) {
+        const auto best = find_free_group();
+        if(best == nullptr) {
             break;
         }
-        r.out.resize(*out_size);
-        if(!fd.read(r.out.data(), *out_size)) {
-            break;
+        auto job = jobs.pop();
+        auto g   = best;
+        // keep the caches of the group warm, unless the job waits too long for it
+        if(const auto recent = find_recent_group(job.get_command()->cwd); recent != nullptr && recent != best && !recent->is_busy() && jobs_ahead(*recent) <= jobs_ahead(*best) + locality) {
+            g = recent;
+            metrics.jobs_placed_locally += 1;
+        } else if(recent == best) {
+            metrics.jobs_placed_locally += 1;
         }
-
-        const auto err_size = fd.read<size_t>();
-        if(!err_size.has_value()) {
-            break;
-        }
-        r.err.resize(*err_size);
-        if(!fd.read(r.err.data(), *err_size)) {
-            break;
+        auto p = std::find_if(pending.begin(), pending.end(), [g](const Pending& p) { return p.group == g; });
+        if(p == pending.end()) {
+            p = pending.insert(p, Pending{g, begin_packet(g->get_writer().get_buffer(), WorkerGroupMessage::JOB), 0});
         }
-        return r;
-    } while(0);
-    panic("Failed to parse error packet");
-    return {};
+        remember_group(job.get_command()->cwd, *g);
+        dispatch_job(*g, std::move(job), now);
+        p->count += 1;
+    }
+    for(const auto& p : pending) {
+        finish_packet(p.group->get_writer().get_buffer(), p.packet);
+        metrics.jobs_dispatched += p.count;
+    }
+    for(const auto& p : pending) {
+        flush_group(*p.group);
+    }
 }
-} // namespace
 auto Server::assign_jobs(WorkerGroup* target) -> void {
+    if(locality >= 0) {
+        assign_jobs_by_locality();
+        revoke_jobs();
+        return;
+    }
     while(!jobs.empty()) {
         auto g = (WorkerGroup*)nullptr;
         if(target != nullptr) {
@@ -130,54 +239,389 @@ auto Server::assign_jobs(WorkerGroup* target) -> void {
                 g = target;
             }
         } else {
-            for(auto& w : worker_groups) {
-                if(!w.is_busy()) {
-                    g = &w;
-                    break;
-                }
-            }
+            g = find_free_group();
         }
         if(g == nullptr) {
             // there is no free worker groups
             return;
         }
+        // pack every job this group can take into a single packet
+        auto&      buffer = g->get_writer().get_buffer();
+        const auto packet = begin_packet(buffer, WorkerGroupMessage::JOB);
+        auto       count  = uint32_t(0);
+        const auto now    = std::chrono::steady_clock::now();
         while(!jobs.empty() && !g->is_busy()) {
-            const auto& cwd    = jobs[0].get_command()->cwd;
-            const auto& cmd    = jobs[0].get_command()->command;
-            const auto& arg    = jobs[0].get_arg();
-            const auto  packet = build_job_packet(cwd, cmd, arg);
-            print("[", jobs.size() - 1, "] \"", cwd, "\" \"", arg, '"');
-            jobs.erase(jobs.begin());
-            const auto& fd = g->get_fd();
-            if(!fd.write(packet.data(), packet.size())) {
-                panic("Failed to send job packet");
+            dispatch_job(*g, jobs.pop(), now);
+            count += 1;
+        }
+        finish_packet(buffer, packet);
+        metrics.jobs_dispatched += count;
+        flush_group(*g);
+    }
+    revoke_jobs();
+}
+auto Server::revoke_jobs() -> void {
+    // the queue is drained, take prefetched jobs back if some workers have nothing to do
+    auto idle = uint32_t(0);
+    for(const auto& g : worker_groups) {
+        if(g.is_idle()) {
+            idle += g.get_capacity() - g.get_busy();
+        }
+    }
+    for(auto& g : worker_groups) {
+        if(idle == 0) {
+            break;
+        }
+        // jobs waiting within the locality bound were placed there on purpose
+        const auto keep  = std::max<int64_t>(locality, 0);
+        const auto count = std::min<uint32_t>(idle, std::max<int64_t>(g.get_prefetched() - keep, 0));
+        if(count == 0 || g.is_revoking()) {
+            continue;
+        }
+        auto&      buffer = g.get_writer().get_buffer();
+        const auto packet = begin_packet(buffer, WorkerGroupMessage::REVOKE);
+        wire::append(buffer, count);
+        finish_packet(buffer, packet);
+        g.set_revoking(true);
+        flush_group(g);
+        idle -= count;
+    }
+}
+auto Server::print_output(const WorkerGroup& g, const uint64_t id, const int stream, const char* const data, const size_t len) -> void {
+    const auto job = g.find_job(id);
+    if(cache.has_value() && job != nullptr && job->get_cache_key().has_value() && !uncacheable.contains(id)) {
+        // keep for the cache entry, but do not hold too much
+        auto& saved = streamed[stream - 1][id];
+        if(saved.size() + len <= MAX_CACHED_OUTPUT) {
+            saved.append(data, len);
+        } else {
+            uncacheable.insert(id);
+        }
+    }
+    auto& out = stream == 1 ? std::cout : std::cerr;
+    if(!tag_lines) {
+        out.write(data, len);
+        out.flush();
+        return;
+    }
+    const auto tag = job != nullptr ? std::string(job->get_arg()) : std::to_string(id);
+    write_tagged(out, tag, partial_lines[stream - 1][id], data, len);
+}
+auto Server::flush_output(const WorkerGroup& g, const uint64_t id) -> void {
+    for(auto i = 0; i < 2; i += 1) {
+        const auto p = partial_lines[i].find(id);
+        if(p == partial_lines[i].end()) {
+            continue;
+        }
+        if(!p->second.empty()) {
+            print_output(g, id, i + 1, "\n", 1);
+        }
+        partial_lines[i].erase(id);
+    }
+}
+auto Server::replay_cached(const Job& job, const CacheEntry& entry) -> void {
+    print("Cached \"", job.get_command()->cwd, "\" \"", job.get_arg(), '"');
+    metrics.jobs_cached += 1;
+    if(stream_window == 0) {
+        return;
+    }
+    const auto tag = std::string(job.get_arg());
+    for(auto i = 0; i < 2; i += 1) {
+        const auto& data = i == 0 ? entry.out : entry.err;
+        auto&       out  = i == 0 ? std::cout : std::cerr;
+        if(!tag_lines) {
+            out.write(data.data(), data.size());
+            out.flush();
+            continue;
+        }
+        auto partial = std::string();
+        write_tagged(out, tag, partial, data.data(), data.size());
+        if(!partial.empty()) {
+            write_tagged(out, tag, partial, "\n", 1);
+        }
+    }
+}
+auto Server::filter_cached(std::vector<Job> received) -> std::vector<Job> {
+    auto runnable = std::vector<Job>();
+    runnable.reserve(received.size());
+    auto hits = size_t(0), coalesced = size_t(0);
+    for(auto& job : received) {
+        const auto key = cache->compute_key(job);
+        if(!key.has_value()) {
+            runnable.emplace_back(std::move(job));
+            continue;
+        }
+        // an identical job is queued or running, wait for it
+        if(const auto p = waiting.find(*key); p != waiting.end()) {
+            p->second.emplace_back(std::move(job));
+            coalesced += 1;
+            continue;
+        }
+        // an entry stored without streaming has no output to replay
+        if(const auto entry = cache->load(*key, job); entry.has_value() && (entry->captured || stream_window == 0)) {
+            replay_cached(job, *entry);
+            complete_job(job, false);
+            hits += 1;
+            continue;
+        }
+        waiting.emplace(*key, std::vector<Job>());
+        job.set_cache_key(*key);
+        runnable.emplace_back(std::move(job));
+    }
+    if(hits != 0 || coalesced != 0) {
+        print(hits, " jobs were cached, ", coalesced, " jobs were coalesced");
+    }
+    return runnable;
+}
+auto Server::finish_job(const uint64_t id, Job job, const bool failed) -> void {
+    auto saved = CacheEntry();
+    for(auto i = 0; i < 2; i += 1) {
+        if(const auto p = streamed[i].find(id); p != streamed[i].end()) {
+            (i == 0 ? saved.out : saved.err) = std::move(p->second);
+            streamed[i].erase(p);
+        }
+    }
+    saved.captured = stream_window != 0;
+
+    const auto oversized = uncacheable.erase(id) != 0;
+
+    const auto key = job.get_cache_key();
+    if(!key.has_value()) {
+        return;
+    }
+    const auto p = waiting.find(*key);
+    if(failed) {
+        // run one of the identical jobs again, it may be a transient failure
+        if(p != waiting.end() && !p->second.empty()) {
+            auto next = std::move(p->second.back());
+            p->second.pop_back();
+            next.set_cache_key(*key);
+            jobs.requeue(std::move(next));
+        } else if(p != waiting.end()) {
+            waiting.erase(p);
+        }
+        return;
+    }
+    if(oversized) {
+        // succeeded, but the output cannot be replayed, so run the identical jobs at once
+        if(p != waiting.end()) {
+            auto coalesced = std::move(p->second);
+            waiting.erase(p);
+            for(auto& j : coalesced) {
+                jobs.requeue(std::move(j));
             }
-            g->increment_busy();
+            assign_jobs();
         }
+        return;
+    }
+    if(!cache->store(*key, job, saved)) {
+        warn("Failed to store cache entry");
+    }
+    if(p != waiting.end()) {
+        // completing may release dependent jobs, which may look up waiting again
+        const auto coalesced = std::move(p->second);
+        waiting.erase(p);
+        for(const auto& j : coalesced) {
+            replay_cached(j, saved);
+            complete_job(j, false);
+        }
+    }
+}
+auto Server::order_by_history(std::vector<Job>& submission) const -> void {
+    // longest first, so that a long job does not start last and decide the end of the batch
+    // unknown jobs first, they may be long and their runtime is learned early
+    auto order = std::vector<std::pair<double, size_t>>();
+    order.reserve(submission.size());
+    for(auto i = size_t(0); i < submission.size(); i += 1) {
+        order.emplace_back(history->estimate(submission[i]).value_or(HUGE_VAL), i);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    auto sorted = std::vector<Job>();
+    sorted.reserve(submission.size());
+    for(const auto& [seconds, i] : order) {
+        sorted.emplace_back(std::move(submission[i]));
     }
+    submission = std::move(sorted);
 }
-auto Server::parse_recieved(const std::vector<uint8_t>& data) -> std::vector<Job> {
-    auto reader = ByteReader(data);
-    auto jobs   = std::vector<Job>();
+auto Server::handle_packet(WorkerGroup& g, ByteReader& packet) -> void {
+    const auto type = wire::read<WorkerGroupMessage>(packet);
+    if(!type.has_value()) {
+        panic("Received an empty packet");
+    }
+    switch(*type) {
+    case WorkerGroupMessage::WORKERS: {
+        const auto version = packet.read(sizeof(uint32_t));
+        if(version == nullptr) {
+            panic("Failed to get worker numbers");
+        }
+        // another version may not even frame its packets like us, do not talk to it
+        if(const auto v = wire::read_fixed<uint32_t>(version); v != PROTOCOL_VERSION) {
+            warn("Protocol version of ", get_group_name(g), " is ", v, ", expected ", PROTOCOL_VERSION);
+            close_group(g);
+            return;
+        }
+        const auto reply = wire::read<WorkersReply>(packet);
+        if(!reply.has_value()) {
+            panic("Failed to get worker numbers");
+        }
+        g.set_workers(reply->workers);
+        g.set_clock(reply->timestamp, steady_ns());
+        warn("Conected to new workers: ", get_group_name(g));
+        if(trace.has_value()) {
+            trace->add_group(g.get_serial() + 1, get_group_name(g), reply->workers);
+        }
+        if(stream_window != 0) {
+            auto&      buffer = g.get_writer().get_buffer();
+            const auto packet = begin_packet(buffer, WorkerGroupMessage::CREDIT);
+            wire::append(buffer, stream_window);
+            finish_packet(buffer, packet);
+        }
+        assign_jobs(&g);
+    } break;
+    case WorkerGroupMessage::DONE: {
+        const auto now         = std::chrono::steady_clock::now();
+        auto&      group_usage = metrics.usage_by_group[get_group_name(g)];
+        for(const auto& done : read_done_packet(packet)) {
+            flush_output(g, done.id);
+            auto job = g.pop_job(done.id);
+            metrics.jobs_completed += 1;
+            metrics.job_duration.observe(std::chrono::duration<double>(now - job.get_dispatched()).count());
+            metrics.usage_by_command[job.get_command()->command].add(done.usage);
+            group_usage.add(done.usage);
+            if(history.has_value()) {
+                history->record(job, done.usage.wall);
+            }
+            if(trace.has_value()) {
+                trace->add_job(job, done.id, g.get_serial() + 1, done.slot, g.to_local_time(done.started), g.to_local_time(done.finished), done.usage);
+            }
+            const auto failed = failed_jobs.erase(done.id) != 0;
+            complete_job(job, failed);
+            finish_job(done.id, std::move(job), failed);
+        }
+        // flushing for every packet would cost a write per packet, the main loop flushes by the deadline
+        if((trace.has_value() || history.has_value()) && !logs_deadline.has_value()) {
+            logs_deadline = steady_ns() + LOGS_FLUSH_INTERVAL;
+        }
+        assign_jobs(&g);
+    } break;
+    case WorkerGroupMessage::REVOKED: {
+        const auto ids = wire::read<std::vector<uint64_t>>(packet);
+        if(!ids.has_value()) {
+            panic("Failed to read job ids");
+        }
+        for(const auto id : *ids) {
+            jobs.requeue(g.pop_job(id));
+            metrics.jobs_requeued += 1;
+        }
+        g.set_revoking(false);
+        assign_jobs();
+    } break;
+    case WorkerGroupMessage::ERROR: {
+        const auto r = wire::read<ErrorPacket>(packet);
+        if(!r.has_value()) {
+            panic("Failed to parse error packet");
+        }
+        failed_jobs.insert(r->id);
+        metrics.jobs_failed += 1;
+        if(r->exitted) {
+            warn("Command \"", r->command, "\" returned exit code ", static_cast<int>(r->code));
+            warn("=== stdout ===\n", format_output(r->out), "\n");
+            warn("=== stderr ===\n", format_output(r->err), "\n");
+        } else {
+            warn("Command \"", r->command, "\" terminated by signal ", static_cast<int>(r->code));
+        }
+    } break;
+    case WorkerGroupMessage::CAPACITY: {
+        const auto count = wire::read<uint32_t>(packet);
+        if(!count.has_value()) {
+            panic("Failed to parse capacity packet");
+        }
+        print("Capacity of ", get_group_name(g), ": ", *count, "/", g.get_workers());
+        g.set_capacity(*count);
+        // prefetched jobs of a shrunk group are taken back by revoke_jobs() if others are idle
+        assign_jobs();
+    } break;
+    case WorkerGroupMessage::OUTPUT: {
+        const auto header = wire::read<OutputHeader>(packet);
+        if(!header.has_value() || (header->stream != 1 && header->stream != 2)) {
+            panic("Failed to parse output packet");
+        }
+        const auto len  = packet.get_remaining();
+        const auto data = packet.read(len);
+        print_output(g, header->id, header->stream, reinterpret_cast<const char*>(data), len);
+        g.add_consumed(len);
+    } break;
+    default:
+        panic("Received an invalid message ", static_cast<int>(*type));
+        break;
+    }
+}
+auto Server::parse_recieved(ByteReader& reader, Client& c) -> std::vector<Job> {
+    auto jobs = std::vector<Job>();
+    // the previous command got no arguments
+    const auto flush_command = [&]() {
+        if(c.command != nullptr && !c.has_argument) {
+            jobs.emplace_back().set_command(c.command);
+        }
+    };
     while(true) {
-        const auto type = reader.read<ClientChunkType>();
-        if(type == nullptr) {
+        const auto type = wire::read<ClientChunkType>(reader);
+        if(!type.has_value()) {
             break;
         }
         switch(*type) {
         case ClientChunkType::COMMAND: {
-            jobs.emplace_back();
-            auto c     = new Command;
-            c->cwd     = reinterpret_cast<const char*>(reader.read_until('\0'));
-            c->command = reinterpret_cast<const char*>(reader.read_until('\0'));
-            jobs.back().set_command(c);
+            const auto cwd     = reader.read_string();
+            const auto command = reader.read_string();
+            if(!cwd.has_value() || !command.has_value()) {
+                return jobs;
+            }
+            flush_command();
+            c.command             = Rc<Command>::make();
+            c.command->cwd        = *cwd;
+            c.command->command    = *command;
+            c.command->id         = next_command_id;
+            c.command->submission = c.submission;
+            next_command_id += 1;
+            c.has_argument        = false;
         } break;
-        case ClientChunkType::ARGUMENT:
-            if(jobs.back().has_arg()) {
-                jobs.emplace_back();
-                jobs.back().set_command(*(jobs.end() - 2));
+        case ClientChunkType::INPUT: {
+            const auto input = reader.read_string();
+            if(c.command == nullptr || !input.has_value()) {
+                return jobs;
             }
-            jobs.back().set_arg(reinterpret_cast<const char*>(reader.read_until('\0')));
+            c.command->inputs.emplace_back(*input);
+        } break;
+        case ClientChunkType::ARGUMENT: {
+            const auto arg = reader.read_string();
+            if(c.command == nullptr || !arg.has_value()) {
+                return jobs;
+            }
+            auto& job = jobs.emplace_back();
+            job.set_command(c.command);
+            job.set_arg(arguments.store(*arg));
+            c.has_argument = true;
+            if(!c.label.empty() || !c.dependencies.empty()) {
+                job.set_node(graphs[c.submission].add(c.label, c.dependencies));
+                c.label.clear();
+                c.dependencies.clear();
+            }
+        } break;
+        case ClientChunkType::LABEL:
+        case ClientChunkType::DEPEND: {
+            const auto str = reader.read_string();
+            if(!str.has_value()) {
+                return jobs;
+            }
+            if(*type == ClientChunkType::LABEL) {
+                c.label = *str;
+            } else {
+                c.dependencies.emplace_back(*str);
+            }
+        } break;
+        case ClientChunkType::WAIT:
+            c.wait = true;
+            waiters.emplace(c.submission, &c);
             break;
         }
     }
@@ -192,6 +636,8 @@ auto Server::handle_command(const std::string& input) -> bool {
         {"quit", "Quit xserver"},
         {"list", "List connected workers"},
         {"connect", "Connect to remote server"},
+        {"metrics", "Print metrics"},
+        {"usage", "Print resource usage of jobs by command and by worker group"},
         {"help", "Print this help"},
     };
     constexpr auto N_COMMANDS = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
@@ -205,7 +651,8 @@ auto Server::handle_command(const std::string& input) -> bool {
         case 1:
             print("Connected workers:");
             for(const auto& w : worker_groups) {
-                print("    ", w.get_address() == 0 ? "local" : inet_ntoa({w.get_address()}), " ", w.get_busy(), "/", w.get_workers());
+                const auto reduced = w.get_capacity() < w.get_workers() ? " (capacity " + std::to_string(w.get_capacity()) + ")" : std::string();
+                print("    ", get_group_name(w), " ", w.get_busy(), "/", w.get_workers(), reduced);
             }
             break;
         case 2: {
@@ -214,13 +661,23 @@ auto Server::handle_command(const std::string& input) -> bool {
                 warn("Invalid address");
                 break;
             }
-            if(const auto p = add_worker_group(input.substr(s + 1)); p != nullptr) {
-                update_epoll_handle_data();
-                assign_jobs(p);
-            }
+            add_worker_group(input.substr(s + 1));
             break;
         }
         case 3:
+            std::cout << render_metrics();
+            break;
+        case 4:
+            print("Usage by command:");
+            for(const auto& [command, usage] : metrics.usage_by_command) {
+                print("    ", format_usage(usage), "  ", command);
+            }
+            print("Usage by worker group:");
+            for(const auto& [group, usage] : metrics.usage_by_group) {
+                print("    ", format_usage(usage), "  ", group);
+            }
+            break;
+        case 5:
             for(size_t i = 0; i < N_COMMANDS; i += 1) {
                 print(COMMANDS[i].command, "   ", COMMANDS[i].help);
             }
@@ -232,12 +689,12 @@ auto Server::handle_command(const std::string& input) -> bool {
 }
 auto Server::add_worker_group(const std::string& address) -> WorkerGroup* {
     if(address == "local" || address == "0") {
-        if(auto r = open_local_client_socket("\0xrun-local-worker"); r.message != nullptr) {
+        if(auto r = open_local_client_socket(local_worker_socket_name(name).data()); r.message != nullptr) {
             warn("Failed to create connection to local server: ", r.message);
             return nullptr;
         } else {
-            worker_groups.emplace_back(WorkerGroup(0, r.fd));
-            return &worker_groups.back();
+            // already connected, and the local xworker answers at once
+            worker_groups.emplace_back(next_group_serial, 0, r.fd, prefetch, false, std::nullopt);
         }
     } else {
         const auto addr_opt = parse_str_to_address(address);
@@ -251,10 +708,450 @@ auto Server::add_worker_group(const std::string& address) -> WorkerGroup* {
             warn("Failed to create connection to remote server ", address, ": ", r.message);
             return nullptr;
         } else {
-            worker_groups.emplace_back(WorkerGroup(addr.first, r.fd));
-            return &worker_groups.back();
+            const auto deadline = connect_timeout != 0 ? std::optional(steady_ns() + connect_timeout) : std::nullopt;
+            worker_groups.emplace_back(next_group_serial, addr.first, r.fd, prefetch, true, deadline);
+        }
+    }
+
+    // the connection and the handshake complete asynchronously, see handle_worker_group() and WorkerGroupMessage::WORKERS
+    auto& g = worker_groups.back();
+    next_group_serial += 1;
+    if(!g.get_fd().set_nonblocking()) {
+        panic("fcntl() failed: ", errno);
+    }
+    add_epoll_handle(g.get_fd(), &g);
+    flush_group(g);
+    return &g;
+}
+auto Server::handle_stdin(const uint32_t events) -> bool {
+    if(events & EPOLLHUP || events & EPOLLERR) {
+        // panic() skips the flush at the end of run()
+        flush_logs();
+        panic("stdin closed");
+    } else if(events & EPOLLIN) {
+        constexpr auto BUF_LEN = 64;
+        char           buf[BUF_LEN + 1];
+        buf[BUF_LEN] = '\0';
+        if(read(fileno(stdin), buf, BUF_LEN) < 0) {
+            panic("read() failed.");
+        }
+        if(const auto c = std::strchr(buf, '\n'); c != NULL) {
+            *c = '\0';
+            input += buf;
+            if(!handle_command(input)) {
+                return false;
+            }
+            input.clear();
+        } else {
+            input += buf;
+        }
+    }
+    return true;
+}
+auto Server::accept_client() -> void {
+    auto c = Connection::connect(xrun_socket);
+    if(!c.has_value()) {
+        panic("Failet to accept xrun");
+    }
+    if(!c->get_fd().set_nonblocking()) {
+        panic("fcntl() failed: ", errno);
+    }
+    auto& client = clients.emplace_back(std::move(*c), next_submission);
+    next_submission += 1;
+    add_epoll_handle(client.connection.get_fd(), &client);
+}
+auto Server::render_metrics() const -> std::string {
+    auto r = std::string();
+    render_counter(r, "xrun_jobs_received_total", "Jobs submitted by xrun", metrics.jobs_received);
+    render_counter(r, "xrun_jobs_dispatched_total", "Jobs sent to worker groups", metrics.jobs_dispatched);
+    render_counter(r, "xrun_jobs_completed_total", "Jobs reported as done", metrics.jobs_completed);
+    render_counter(r, "xrun_jobs_failed_total", "Jobs exitted with non-zero code or killed by signal", metrics.jobs_failed);
+    render_counter(r, "xrun_jobs_requeued_total", "Jobs given back by revocation or lost connection", metrics.jobs_requeued);
+    render_counter(r, "xrun_jobs_cached_total", "Jobs answered by the result cache", metrics.jobs_cached);
+    render_counter(r, "xrun_jobs_placed_locally_total", "Jobs sent to the group which ran the same directory last", metrics.jobs_placed_locally);
+    render_counter(r, "xrun_jobs_skipped_total", "Jobs not run because a dependency failed", metrics.jobs_skipped);
+    render_gauge(r, "xrun_queue_depth", "Jobs waiting for dispatch", jobs.size());
+    metrics.job_duration.render(r, "xrun_job_duration_seconds", "Time from dispatch to done report");
+
+    auto sent = metrics.bytes_sent, received = metrics.bytes_received, groups = size_t(0);
+    for(const auto& g : worker_groups) {
+        if(g.is_closed()) {
+            continue;
+        }
+        sent += g.get_bytes_sent();
+        received += g.get_bytes_received();
+        groups += 1;
+    }
+    render_counter(r, "xrun_bytes_sent_total", "Bytes sent to worker groups", sent);
+    render_counter(r, "xrun_bytes_received_total", "Bytes received from worker groups", received);
+    render_gauge(r, "xrun_worker_groups", "Connected worker groups", groups);
+
+    struct Gauge {
+        const char* name;
+        const char* help;
+        uint32_t (WorkerGroup::*get)() const;
+    };
+    constexpr Gauge GROUP_GAUGES[] = {
+        {"xrun_group_workers", "Job slots of the worker group", &WorkerGroup::get_workers},
+        {"xrun_group_capacity", "Job slots the worker group is going to use", &WorkerGroup::get_capacity},
+        {"xrun_group_running", "Jobs running on the worker group", &WorkerGroup::get_running},
+        {"xrun_group_prefetched", "Jobs queued on the worker group", &WorkerGroup::get_prefetched},
+    };
+    for(const auto& gauge : GROUP_GAUGES) {
+        render_header(r, gauge.name, "gauge", gauge.help);
+        for(const auto& g : worker_groups) {
+            if(g.is_closed()) {
+                continue;
+            }
+            const auto labels = "group=\"" + get_group_name(g) + "\"";
+            render_value(r, gauge.name, labels.data(), (g.*gauge.get)());
+        }
+    }
+
+    render_header(r, "xrun_group_cpu_seconds_total", "counter", "CPU time of finished jobs");
+    for(const auto& [group, usage] : metrics.usage_by_group) {
+        render_value(r, "xrun_group_cpu_seconds_total", ("group=\"" + group + "\",mode=\"user\"").data(), usage.user);
+        render_value(r, "xrun_group_cpu_seconds_total", ("group=\"" + group + "\",mode=\"system\"").data(), usage.system);
+    }
+    render_header(r, "xrun_group_wall_seconds_total", "counter", "Wall time of finished jobs");
+    for(const auto& [group, usage] : metrics.usage_by_group) {
+        render_value(r, "xrun_group_wall_seconds_total", ("group=\"" + group + "\"").data(), usage.wall);
+    }
+    render_header(r, "xrun_group_max_rss_kilobytes", "gauge", "Largest resident set size of finished jobs");
+    for(const auto& [group, usage] : metrics.usage_by_group) {
+        render_value(r, "xrun_group_max_rss_kilobytes", ("group=\"" + group + "\"").data(), usage.max_rss_kb);
+    }
+    return r;
+}
+auto Server::serve_metrics() -> void {
+    auto c = Connection::connect(metrics_socket);
+    if(!c.has_value()) {
+        warn("Failed to accept metrics client");
+        return;
+    }
+    if(!c->get_fd().set_nonblocking()) {
+        panic("fcntl() failed: ", errno);
+    }
+    auto&      client = metrics_clients.emplace_back(std::move(*c));
+    const auto text   = render_metrics();
+    append_bytes(client.writer.get_buffer(), text.data(), text.size());
+    if(!client.writer.flush(client.connection.get_fd())) {
+        warn("Failed to send metrics: ", errno);
+        client.closed = true;
+        return;
+    }
+    if(!client.writer.is_pending()) {
+        client.closed = true;
+        return;
+    }
+    // the rest is written as the scraper reads
+    auto evset = epoll_event{.events = EPOLLOUT, .data = {&client}};
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, client.connection.get_fd(), &evset) < 0) {
+        panic("epoll_ctl() failed: ", errno);
+    }
+}
+auto Server::flush_metrics(MetricsClient& c) -> void {
+    if(!c.writer.flush(c.connection.get_fd())) {
+        warn("Failed to send metrics: ", errno);
+    } else if(c.writer.is_pending()) {
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c.connection.get_fd(), NULL);
+    c.closed = true;
+}
+auto Server::enqueue_received(Client& c, std::vector<Job> received) -> void {
+    if(received.empty()) {
+        return;
+    }
+    print("Received ", received.size(), " jobs");
+    metrics.jobs_received += received.size();
+    c.received += received.size();
+    const auto now = std::chrono::steady_clock::now();
+    for(auto& job : received) {
+        job.set_enqueued(now);
+    }
+    // jobs waiting for others stay in the graph, the rest is submitted before any of them can finish
+    auto skipped = std::vector<Job>();
+    if(const auto g = graphs.find(c.submission); g != graphs.end()) {
+        auto ready = std::vector<Job>();
+        ready.reserve(received.size());
+        for(auto& job : received) {
+            if(!job.get_node().has_value()) {
+                ready.emplace_back(std::move(job));
+                continue;
+            }
+            switch(g->second.hold(job)) {
+            case DependencyState::READY:
+                ready.emplace_back(std::move(job));
+                break;
+            case DependencyState::WAITING:
+                break;
+            case DependencyState::FAILED:
+                skipped.emplace_back(std::move(job));
+                break;
+            }
+        }
+        received = std::move(ready);
+    }
+    submit_jobs(c.submission, std::move(received));
+    for(const auto& job : skipped) {
+        skip_job(job);
+    }
+}
+auto Server::submit_jobs(const uint64_t submission, std::vector<Job> received) -> void {
+    if(cache.has_value()) {
+        received = filter_cached(std::move(received));
+    }
+    if(history.has_value()) {
+        order_by_history(received);
+    }
+    jobs.push(submission, std::move(received));
+    assign_jobs();
+}
+auto Server::end_graph(const uint64_t submission) -> void {
+    if(const auto g = graphs.find(submission); g != graphs.end()) {
+        g->second.set_ended();
+        if(g->second.is_done()) {
+            graphs.erase(g);
+        }
+    }
+}
+auto Server::complete_job(const Job& job, const bool failed) -> void {
+    const auto submission = job.get_command()->submission;
+    if(const auto node = job.get_node(); node.has_value()) {
+        if(const auto g = graphs.find(submission); g != graphs.end()) {
+            auto ready = std::vector<Job>(), skipped = std::vector<Job>();
+            g->second.finish(*node, failed, ready, skipped);
+            if(g->second.is_done()) {
+                graphs.erase(g);
+            }
+            if(!ready.empty()) {
+                print("Released ", ready.size(), " jobs");
+                submit_jobs(submission, std::move(ready));
+            }
+            for(const auto& j : skipped) {
+                skip_job(j);
+            }
         }
     }
+    const auto p = waiters.find(submission);
+    if(p == waiters.end()) {
+        return;
+    }
+    auto& c = *p->second;
+    c.finished += 1;
+    c.failed += failed ? 1 : 0;
+    report_progress(c);
+}
+auto Server::skip_job(const Job& job) -> void {
+    warn("Skipped \"", job.get_command()->cwd, "\" \"", job.get_arg(), "\", a dependency failed");
+    metrics.jobs_skipped += 1;
+    complete_job(job, true);
+}
+auto Server::report_progress(Client& c) -> void {
+    const auto now  = std::chrono::steady_clock::now();
+    const auto done = c.eof && c.finished == c.received;
+    // progress is only informative, skip it while xrun is behind
+    if(c.complete || (!done && (c.writer.is_pending() || now - c.last_progress < std::chrono::milliseconds(100)))) {
+        return;
+    }
+    c.last_progress   = now;
+    c.complete        = done;
+    auto&      buffer = c.writer.get_buffer();
+    const auto packet = begin_packet(buffer, done ? ClientMessage::FINISHED : ClientMessage::PROGRESS);
+    wire::append(buffer, Progress{c.received, c.finished, c.failed});
+    finish_packet(buffer, packet);
+    flush_client(c);
+}
+auto Server::flush_client(Client& c) -> void {
+    if(!c.writer.flush(c.connection.get_fd())) {
+        close_client(c);
+        return;
+    }
+    if(c.complete && !c.writer.is_pending()) {
+        close_client(c);
+        return;
+    }
+    // stop reading after eof, it would be reported forever
+    const auto events = (c.eof ? 0u : EPOLLIN) | (c.writer.is_pending() ? EPOLLOUT : 0u);
+    auto       evset  = epoll_event{.events = events, .data = {&c}};
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, c.connection.get_fd(), &evset) < 0) {
+        panic("epoll_ctl() failed: ", errno);
+    }
+}
+auto Server::handle_client(Client& c, const uint32_t events) -> void {
+    if(events & EPOLLERR || (c.eof && events & EPOLLHUP)) {
+        close_client(c);
+        return;
+    }
+    if(events & EPOLLOUT) {
+        flush_client(c);
+    }
+    if(c.closed || c.eof) {
+        return;
+    }
+    // xrun may stream arguments, each packet is enqueued as it arrives and eof ends the submission
+    if(!c.reader.fill(c.connection.get_fd())) {
+        if(c.reader.is_oversized()) {
+            warn("xrun sent an oversized packet, dropping the connection");
+            close_client(c);
+            return;
+        }
+        if(c.command == nullptr) {
+            warn("xrun disconnected before sending jobs");
+        } else if(!c.has_argument) {
+            auto job = Job();
+            job.set_command(c.command);
+            enqueue_received(c, {std::move(job)});
+        }
+        end_graph(c.submission);
+        if(!c.wait) {
+            close_client(c);
+            return;
+        }
+        c.eof = true;
+        flush_client(c);
+        report_progress(c);
+        return;
+    }
+    while(true) {
+        auto packet = c.reader.next();
+        if(!packet.has_value()) {
+            break;
+        }
+        enqueue_received(c, parse_recieved(*packet, c));
+    }
+}
+auto Server::handle_worker_group(WorkerGroup& g, const uint32_t events) -> void {
+    if(g.is_connecting()) {
+        if(const auto error = get_socket_error(g.get_fd()); error != 0) {
+            warn("Failed to connect to ", get_group_name(g), ": ", strerror(error));
+            close_group(g);
+            return;
+        }
+        g.set_connected();
+    }
+    if(events & EPOLLOUT) {
+        flush_group(g);
+    }
+    if(g.is_closed()) {
+        return;
+    }
+    if(events & EPOLLERR) {
+        close_group(g);
+        return;
+    }
+    if(!(events & EPOLLIN || events & EPOLLHUP)) {
+        return;
+    }
+    auto& reader = g.get_reader();
+    if(!reader.fill(g.get_fd())) {
+        if(reader.is_oversized()) {
+            warn(get_group_name(g), " sent an oversized packet");
+        }
+        close_group(g);
+        return;
+    }
+    while(!g.is_closed()) {
+        auto packet = reader.next();
+        if(!packet.has_value()) {
+            break;
+        }
+        handle_packet(g, *packet);
+    }
+    // give back the credit in batches, not for every packet
+    if(!g.is_closed() && stream_window != 0 && g.get_consumed() >= stream_window / 4) {
+        auto&      buffer = g.get_writer().get_buffer();
+        const auto packet = begin_packet(buffer, WorkerGroupMessage::CREDIT);
+        wire::append(buffer, g.take_consumed());
+        finish_packet(buffer, packet);
+        flush_group(g);
+    }
+}
+auto Server::flush_group(WorkerGroup& g) -> void {
+    // nothing can be sent before the connection is established, it is notified by EPOLLOUT
+    if(!g.is_connecting() && !g.flush()) {
+        close_group(g);
+        return;
+    }
+    // watch EPOLLOUT only while something is left to send
+    if(const auto pending = g.get_writer().is_pending(); pending != g.is_watching_output()) {
+        auto evset = epoll_event{.events = EPOLLIN | (pending ? EPOLLOUT : 0u), .data = {&g}};
+        if(epoll_ctl(epfd, EPOLL_CTL_MOD, g.get_fd(), &evset) < 0) {
+            panic("epoll_ctl() failed: ", errno);
+        }
+        g.set_watching_output(pending);
+    }
+}
+auto Server::close_group(WorkerGroup& g) -> void {
+    if(g.is_closed()) {
+        return;
+    }
+    warn("Connection closed: ", get_group_name(g));
+    epoll_ctl(epfd, EPOLL_CTL_DEL, g.get_fd(), NULL);
+    g.set_closed();
+    for(auto i = 0; i < 2; i += 1) {
+        const auto lost = [&g](const auto& p) { return g.find_job(p.first) != nullptr; };
+        std::erase_if(partial_lines[i], lost);
+        std::erase_if(streamed[i], lost);
+    }
+    std::erase_if(uncacheable, [&g](const uint64_t id) { return g.find_job(id) != nullptr; });
+    std::erase_if(failed_jobs, [&g](const uint64_t id) { return g.find_job(id) != nullptr; });
+    std::erase_if(recent_groups, [&g](const auto& p) { return p.second == g.get_serial(); });
+    metrics.bytes_sent += g.get_bytes_sent();
+    metrics.bytes_received += g.get_bytes_received();
+    // the group is erased after the current epoll events are handled
+    auto lost = g.take_jobs();
+    if(!lost.empty()) {
+        warn("Requeued ", lost.size(), " jobs");
+        metrics.jobs_requeued += lost.size();
+        for(auto& job : lost) {
+            jobs.requeue(std::move(job));
+        }
+        assign_jobs();
+    }
+}
+// closes worker groups which are not ready in time, returns the timeout for epoll_wait() until the next deadline
+auto Server::expire_groups() -> int {
+    const auto now  = steady_ns();
+    auto       next = std::optional<int64_t>();
+    for(auto& g : worker_groups) {
+        const auto deadline = g.get_deadline();
+        if(g.is_ready() || g.is_closed() || !deadline.has_value()) {
+            continue;
+        }
+        if(*deadline <= now) {
+            warn("Timed out connecting to ", get_group_name(g));
+            close_group(g);
+            continue;
+        }
+        next = std::min(next.value_or(*deadline), *deadline);
+    }
+    if(!next.has_value()) {
+        return -1;
+    }
+    // round up, so that the deadline has passed at the next call
+    return (*next - now + 999999) / 1000000;
+}
+auto Server::flush_logs() -> void {
+    if(trace.has_value()) {
+        trace->flush();
+    }
+    if(history.has_value()) {
+        history->flush();
+    }
+    logs_deadline.reset();
+}
+auto Server::close_client(Client& c) -> void {
+    if(c.closed) {
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c.connection.get_fd(), NULL);
+    c.closed = true;
+    if(c.wait) {
+        waiters.erase(c.submission);
+    }
+    end_graph(c.submission);
 }
 auto Server::add_epoll_handle(const int fd, const void* const data) -> void {
     auto evset = epoll_event{.events = EPOLLIN, .data = {const_cast<void*>(data)}};
@@ -262,122 +1159,104 @@ auto Server::add_epoll_handle(const int fd, const void* const data) -> void {
         panic("epoll_ctl() failed: ", errno);
     }
 }
-auto Server::update_epoll_handle_data() const -> void {
-    auto evset = epoll_event{.events = EPOLLIN};
-    for(const auto& g : worker_groups) {
-        evset.data.ptr = const_cast<WorkerGroup*>(&g);
-        epoll_ctl(epfd, EPOLL_CTL_MOD, g.get_fd(), &evset);
-    }
-}
 auto Server::run(const Args& args) -> void {
+    // writing to a lost worker should not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
     // open socket for xrun
-    auto xrun_socket = FileDescriptor(-1);
-    if(auto r = open_local_server_socket("\0xrun"); r.message != nullptr) {
+    name = args.name;
+    if(auto r = open_local_server_socket(server_socket_name(name).data()); r.message != nullptr) {
         panic("xserver already running: ", r.message);
     } else {
         xrun_socket = r.fd;
     }
 
+    prefetch        = args.prefetch;
+    stream_window   = args.stream || args.tag ? args.window : 0;
+    locality        = args.locality;
+    tag_lines       = args.tag;
+    connect_timeout = int64_t(args.timeout) * 1000000000;
+    if(args.cache != nullptr) {
+        cache.emplace(args.cache);
+    }
+    if(args.trace != nullptr) {
+        trace.emplace(args.trace);
+    }
+    if(args.history != nullptr) {
+        history.emplace(args.history);
+    }
+
     // setup epoll
     epfd = FileDescriptor(epoll_create(1));
     if(epfd < 0) {
         panic("epoll_create() failed: ", errno);
     }
-    add_epoll_handle(fileno(stdin), nullptr);
-    add_epoll_handle(xrun_socket, &xrun_socket);
+    add_epoll_handle(fileno(stdin), &stdin_source);
+    add_epoll_handle(xrun_socket, &listener_source);
+    if(auto r = open_local_server_socket(metrics_socket_name(name).data()); r.message != nullptr) {
+        panic("Failed to open metrics socket: ", r.message);
+    } else {
+        metrics_socket = r.fd;
+    }
+    add_epoll_handle(metrics_socket, &metrics_source);
 
     // create connection to local worker group
-    if(const auto p = add_worker_group("0"); p != nullptr) {
-        add_epoll_handle(p->get_fd(), p);
-    }
+    add_worker_group("0");
 
-    // create connections to remote worker group
+    // start connections to remote worker groups, they join as each of them replies
     for(const auto& a : args.remotes) {
-        if(const auto p = add_worker_group(a); p != nullptr) {
-            add_epoll_handle(p->get_fd(), p);
-        }
-    }
-    if(!worker_groups.empty()) {
-        update_epoll_handle_data();
+        add_worker_group(a);
     }
 
     // main loop
-    auto input = std::string();
-    auto ev    = epoll_event();
-    while(true) {
-        if(epoll_wait(epfd, &ev, 1, -1) < 0) {
-            panic("epoll_wait() failed: ", errno);
-        }
-        if(ev.data.ptr == nullptr) {
-            // stdin
-            if(ev.events & EPOLLHUP || ev.events & EPOLLERR) {
-                panic("stdin closed");
-            } else if(ev.events & EPOLLIN) {
-                constexpr auto BUF_LEN = 64;
-                char           buf[BUF_LEN + 1];
-                buf[BUF_LEN] = '\0';
-                if(read(fileno(stdin), buf, BUF_LEN) < 0) {
-                    panic("read() failed.");
-                }
-                if(const auto c = std::strchr(buf, '\n'); c != NULL) {
-                    *c = '\0';
-                    input += buf;
-                    if(!handle_command(input)) {
-                        break;
-                    }
-                    input.clear();
-                } else {
-                    input += buf;
-                }
+    constexpr auto MAX_EVENTS = 64;
+    auto           events     = std::array<epoll_event, MAX_EVENTS>();
+    auto           running    = true;
+    while(running) {
+        auto timeout = expire_groups();
+        if(logs_deadline.has_value()) {
+            if(const auto now = steady_ns(); *logs_deadline <= now) {
+                flush_logs();
+            } else {
+                const auto left = int((*logs_deadline - now + 999999) / 1000000);
+                timeout         = timeout < 0 ? left : std::min(timeout, left);
             }
-        } else if(ev.data.ptr == &xrun_socket) {
-            // xrun
-            auto c = Connection::connect(xrun_socket);
-            if(!c.has_value()) {
-                panic("Failet to accept xrun");
-            }
-            const auto res = c->get_fd().read_sized();
-            if(!res.has_value()) {
-                panic("Failed to read packet from xrun");
+        }
+        const auto count = epoll_wait(epfd, events.data(), MAX_EVENTS, timeout);
+        if(count < 0) {
+            if(errno == EINTR) {
+                continue;
             }
-            const auto received = parse_recieved(*res);
-            print("Received ", received.size(), " jobs");
-            std::copy(received.begin(), received.end(), std::back_inserter(jobs));
-            assign_jobs();
-        } else {
-            // xworker
-            auto& g = *static_cast<WorkerGroup*>(ev.data.ptr);
-            if(ev.events & EPOLLHUP || ev.events & EPOLLERR) {
-                warn("Connection closed: ", g.get_address() == 0 ? "local" : inet_ntoa({g.get_address()}));
-                epoll_ctl(epfd, EPOLL_CTL_DEL, g.get_fd(), NULL);
-                worker_groups.erase(worker_groups.begin() + (&g - worker_groups.data()));
-                update_epoll_handle_data();
-            } else if(ev.events & EPOLLIN) {
-                const auto type = g.get_fd().read<WorkerGroupMessage>();
-                if(!type.has_value()) {
-                    panic("read() failed.");
-                }
-                switch(*type) {
-                case WorkerGroupMessage::DONE:
-                    g.decrement_busy();
-                    assign_jobs(&g);
-                    break;
-                case WorkerGroupMessage::ERROR: {
-                    const auto r = parse_error_packet(g.get_fd());
-                    if(r.exitted) {
-                        warn("Command \"", r.command, "\" returned exit code ", static_cast<int>(r.code));
-                        warn("=== stdout ===\n", r.out, "\n");
-                        warn("=== stderr ===\n", r.err, "\n");
-                    } else {
-                        warn("Command \"", r.command, "\" terminated by signal ", static_cast<int>(r.code));
-                    }
-                } break;
-                default:
-                    panic("Received an invalid message ", static_cast<int>(*type));
-                    break;
-                }
+            panic("epoll_wait() failed: ", errno);
+        }
+        for(auto i = 0; i < count && running; i += 1) {
+            const auto& ev = events[i];
+            switch(static_cast<EventSource*>(ev.data.ptr)->source_type) {
+            case EventSourceType::STDIN:
+                running = handle_stdin(ev.events);
+                break;
+            case EventSourceType::LISTENER:
+                accept_client();
+                break;
+            case EventSourceType::CLIENT:
+                handle_client(*static_cast<Client*>(ev.data.ptr), ev.events);
+                break;
+            case EventSourceType::WORKER_GROUP:
+                handle_worker_group(*static_cast<WorkerGroup*>(ev.data.ptr), ev.events);
+                break;
+            case EventSourceType::METRICS:
+                serve_metrics();
+                break;
+            case EventSourceType::METRICS_CLIENT:
+                flush_metrics(*static_cast<MetricsClient*>(ev.data.ptr));
+                break;
             }
         }
+        // events of this round may point to closed ones, so erase them here
+        worker_groups.remove_if([](const WorkerGroup& g) { return g.is_closed(); });
+        clients.remove_if([](const Client& c) { return c.closed; });
+        metrics_clients.remove_if([](const MetricsClient& c) { return c.closed; });
     }
+    flush_logs();
 }
 } // namespace xrun
@@ -1,21 +1,156 @@
 #pragma once
+#include <list>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../byte.hpp"
+#include "../packet.hpp"
 #include "../socket.hpp"
+#include "arena.hpp"
 #include "arg.hpp"
+#include "cache.hpp"
+#include "event.hpp"
+#include "graph.hpp"
+#include "history.hpp"
+#include "metrics.hpp"
+#include "queue.hpp"
+#include "trace.hpp"
 #include "worker.hpp"
 
 namespace xrun {
+// connection from xrun
+struct Client : public EventSource {
+    Connection   connection;
+    PacketReader reader;
+    PacketWriter writer; // progress for --wait
+    uint64_t     submission;
+    Rc<Command>  command;              // of the following arguments, they may come in later packets
+    bool         has_argument = false; // a command without arguments runs once with an empty one
+    bool         closed       = false;
+
+    // for the next argument
+    std::string              label;
+    std::vector<std::string> dependencies;
+
+    // for --wait
+    bool      wait     = false;
+    bool      eof      = false; // the submission ended
+    bool      complete = false; // FINISHED is sent
+    uint64_t  received = 0;
+    uint64_t  finished = 0;
+    uint64_t  failed   = 0;
+    TimePoint last_progress;
+
+    Client(Connection connection, const uint64_t submission) : EventSource{EventSourceType::CLIENT}, connection(std::move(connection)), submission(submission) {}
+};
+
+// scraper of metrics, the text is written as the socket accepts it
+struct MetricsClient : public EventSource {
+    Connection   connection;
+    PacketWriter writer;
+    bool         closed = false;
+
+    MetricsClient(Connection connection) : EventSource{EventSourceType::METRICS_CLIENT}, connection(std::move(connection)) {}
+};
+
+// allows lookups by std::string_view without building a std::string
+struct StringHash {
+    using is_transparent = void;
+
+    auto operator()(const std::string_view s) const -> size_t {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
 class Server {
   private:
-    std::vector<Job>         jobs;
-    std::vector<WorkerGroup> worker_groups;
-    FileDescriptor           epfd;
+    JobQueue                                  jobs;
+    StringArena                               arguments; // of received jobs
+    std::list<WorkerGroup>                    worker_groups;
+    std::list<Client>                         clients;
+    FileDescriptor                            epfd;
+    FileDescriptor                            xrun_socket;
+    EventSource                               stdin_source    = {EventSourceType::STDIN};
+    EventSource                               listener_source = {EventSourceType::LISTENER};
+    EventSource                               metrics_source  = {EventSourceType::METRICS};
+    FileDescriptor                            metrics_socket;
+    std::list<MetricsClient>                  metrics_clients;
+    Metrics                                   metrics;
+    std::optional<Trace>                      trace;
+    std::optional<RuntimeHistory>             history;
+    std::optional<int64_t>                    logs_deadline; // steady_ns() to flush trace and history by, while they have unflushed records
+    std::string                               input;
+    std::string                               name;
+    uint64_t                                  next_job_id       = 0;
+    uint32_t                                  next_group_serial = 0;
+    uint64_t                                  next_submission   = 0;
+    uint64_t                                  next_command_id   = 0;
+    uint32_t                                  prefetch          = 0;
+    uint64_t                                  stream_window     = 0; // 0 disables streaming output
+    bool                                      tag_lines         = false;
+    int64_t                                   locality          = -1; // jobs allowed ahead on a recent group, -1 disables
+    int64_t                                   connect_timeout   = 0;  // nanoseconds for a remote worker group to become ready, 0 disables
+    std::unordered_map<uint64_t, std::string> partial_lines[2]; // incomplete lines for tagging, per stream
+
+    // nanoseconds trace and history may lag behind finished jobs
+    constexpr static auto LOGS_FLUSH_INTERVAL = int64_t(1000000000);
+
+    // result cache
+    constexpr static auto MAX_CACHED_OUTPUT = size_t(1024 * 1024);
+
+    std::optional<ResultCache>                     cache;
+    std::unordered_map<uint64_t, std::vector<Job>> waiting;     // cache key of queued or running jobs -> identical jobs
+    std::unordered_map<uint64_t, std::string>      streamed[2]; // output of running jobs for the cache, per stream
+    std::unordered_set<uint64_t>                   uncacheable; // running jobs which printed too much to cache
+
+    std::unordered_map<uint64_t, Client*> waiters;     // submission -> xrun waiting for it
+    std::unordered_set<uint64_t>          failed_jobs; // running jobs which reported an error
+
+    std::unordered_map<uint64_t, DependencyGraph> graphs; // submission -> jobs with labels or dependencies
+
+    // directory of jobs -> serial of the group which ran a job there last, entries of closed groups are dropped
+    std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> recent_groups;
 
+    auto find_free_group() -> WorkerGroup*;
+    auto find_recent_group(const std::string& cwd) -> WorkerGroup*;
+    auto remember_group(const std::string& cwd, const WorkerGroup& g) -> void;
+    auto dispatch_job(WorkerGroup& g, Job job, TimePoint now) -> void;
+    auto assign_jobs_by_locality() -> void;
     auto assign_jobs(WorkerGroup* target = nullptr) -> void;
-    auto parse_recieved(const std::vector<uint8_t>& data) -> std::vector<Job>;
+    auto revoke_jobs() -> void;
+    auto print_output(const WorkerGroup& g, uint64_t id, int stream, const char* data, size_t len) -> void;
+    auto flush_output(const WorkerGroup& g, uint64_t id) -> void;
+    auto replay_cached(const Job& job, const CacheEntry& entry) -> void;
+    auto filter_cached(std::vector<Job> received) -> std::vector<Job>;
+    auto finish_job(uint64_t id, Job job, bool failed) -> void;
+    auto order_by_history(std::vector<Job>& submission) const -> void;
+    auto handle_packet(WorkerGroup& g, ByteReader& packet) -> void;
+    auto parse_recieved(ByteReader& reader, Client& c) -> std::vector<Job>;
+    auto enqueue_received(Client& c, std::vector<Job> received) -> void;
+    auto submit_jobs(uint64_t submission, std::vector<Job> received) -> void;
+    auto end_graph(uint64_t submission) -> void;
+    auto complete_job(const Job& job, bool failed) -> void;
+    auto skip_job(const Job& job) -> void;
+    auto report_progress(Client& c) -> void;
+    auto flush_client(Client& c) -> void;
     auto handle_command(const std::string& input) -> bool;
+    auto handle_stdin(uint32_t events) -> bool;
+    auto handle_client(Client& c, uint32_t events) -> void;
+    auto handle_worker_group(WorkerGroup& g, uint32_t events) -> void;
+    auto accept_client() -> void;
+    auto render_metrics() const -> std::string;
+    auto serve_metrics() -> void;
+    auto flush_metrics(MetricsClient& c) -> void;
     auto add_worker_group(const std::string& address) -> WorkerGroup*;
+    auto flush_group(WorkerGroup& g) -> void;
+    auto close_group(WorkerGroup& g) -> void;
+    auto expire_groups() -> int;
+    auto flush_logs() -> void;
+    auto close_client(Client& c) -> void;
     auto add_epoll_handle(int fd, const void* data) -> void;
-    auto update_epoll_handle_data() const -> void;
 
   public:
     auto run(const Args& args) -> void;
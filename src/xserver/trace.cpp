@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "../error.hpp"
+#include "../protocol.hpp"
+#include "trace.hpp"
+
+namespace xrun {
+namespace {
+auto append_json_string(std::string& out, const std::string_view str) -> void {
+    out += '"';
+    for(const auto c : str) {
+        switch(c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+            break;
+        }
+    }
+    out += '"';
+}
+auto to_ns(const TimePoint time) -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+// trace timestamps are microseconds
+auto format_us(const int64_t ns) -> std::string {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", ns / 1000.0);
+    return buf;
+}
+} // namespace
+auto Trace::begin_event() -> std::string {
+    // the array is closed by the destructor, viewers accept it unclosed too
+    auto event = std::string(empty ? "" : ",\n");
+    empty      = false;
+    return event + "{";
+}
+auto Trace::end_event(std::string& event) -> void {
+    event += "}";
+    file.write(event.data(), event.size());
+}
+auto Trace::add_group(const uint32_t pid, const std::string& name, const uint32_t slots) -> void {
+    auto event = begin_event();
+    event += "\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) + ",\"args\":{\"name\":";
+    append_json_string(event, name);
+    event += "}";
+    end_event(event);
+    for(auto i = uint32_t(0); i < slots; i += 1) {
+        auto event = begin_event();
+        event += "\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) + ",\"tid\":" + std::to_string(i);
+        event += ",\"args\":{\"name\":\"slot " + std::to_string(i) + "\"}";
+        end_event(event);
+    }
+    flush();
+}
+auto Trace::add_job(const Job& job, const uint64_t id, const uint32_t pid, const uint32_t slot, const int64_t started, const int64_t finished, const Usage& usage) -> void {
+    const auto enqueued   = to_ns(job.get_enqueued());
+    const auto dispatched = to_ns(job.get_dispatched());
+    // the clock offset is an estimate, do not let the job start before it was sent
+    const auto start  = std::max(started, dispatched);
+    const auto finish = std::max(finished, start);
+
+    // waiting in the queue, then on the way to and in the prefetch queue of the worker group
+    // async events on the server track, they overlap each other
+    struct Phase {
+        const char* name;
+        int64_t     begin;
+        int64_t     end;
+    };
+    const Phase phases[] = {
+        {"queued", enqueued, dispatched},
+        {"dispatched", dispatched, start},
+    };
+    for(const auto& phase : phases) {
+        for(auto i = 0; i < 2; i += 1) {
+            auto event = begin_event();
+            event += "\"name\":\"" + std::string(phase.name) + "\",\"cat\":\"job\",\"ph\":\"" + (i == 0 ? "b" : "e") + "\",\"id\":" + std::to_string(id);
+            event += ",\"pid\":0,\"tid\":0,\"ts\":" + format_us((i == 0 ? phase.begin : phase.end) - origin);
+            end_event(event);
+        }
+    }
+
+    auto event = begin_event();
+    event += "\"name\":";
+    append_json_string(event, job.get_arg());
+    event += ",\"cat\":\"job\",\"ph\":\"X\",\"pid\":" + std::to_string(pid) + ",\"tid\":" + std::to_string(slot);
+    event += ",\"ts\":" + format_us(start - origin) + ",\"dur\":" + format_us(finish - start);
+    event += ",\"args\":{\"id\":" + std::to_string(id) + ",\"cwd\":";
+    append_json_string(event, job.get_command()->cwd);
+    event += ",\"command\":";
+    append_json_string(event, job.get_command()->command);
+    char buf[128];
+    snprintf(buf, sizeof(buf), ",\"user\":%.6f,\"system\":%.6f,\"max_rss_kb\":%ld", usage.user, usage.system, usage.max_rss_kb);
+    event += buf;
+    event += "}";
+    end_event(event);
+}
+auto Trace::flush() -> void {
+    file.flush();
+}
+Trace::Trace(const char* const path) : file(path), origin(steady_ns()) {
+    if(!file) {
+        panic("Failed to open trace file ", path);
+    }
+    file << "[\n";
+    auto event = begin_event();
+    event += "\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"xserver\"}";
+    end_event(event);
+}
+Trace::~Trace() {
+    file << "\n]\n";
+}
+} // namespace xrun
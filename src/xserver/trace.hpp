@@ -0,0 +1,30 @@
+#pragma once
+#include <fstream>
+#include <string>
+
+#include "metrics.hpp"
+#include "worker.hpp"
+
+namespace xrun {
+// timeline of jobs in Chrome trace event format, viewable with Perfetto or chrome://tracing
+// events are appended as jobs finish and flushed within a second, the file is usable even if xserver is killed
+class Trace {
+  private:
+    std::ofstream file;
+    int64_t       origin; // timestamps are relative to this
+    bool          empty = true;
+
+    auto begin_event() -> std::string;
+    auto end_event(std::string& event) -> void;
+
+  public:
+    // worker group appears as a process, its slots as threads
+    auto add_group(uint32_t pid, const std::string& name, uint32_t slots) -> void;
+    // timestamps are of our clock
+    auto add_job(const Job& job, uint64_t id, uint32_t pid, uint32_t slot, int64_t started, int64_t finished, const Usage& usage) -> void;
+    auto flush() -> void;
+
+    Trace(const char* path);
+    ~Trace();
+};
+} // namespace xrun
@@ -1,46 +1,164 @@
-#include <arpa/inet.h>
+#include <algorithm>
+#include <utility>
 
 #include "../error.hpp"
 #include "../protocol.hpp"
 #include "worker.hpp"
 
 namespace xrun {
+auto WorkerGroup::get_serial() const -> uint32_t {
+    return serial;
+}
 auto WorkerGroup::get_address() const -> const uint32_t {
     return address;
 }
 auto WorkerGroup::get_fd() const -> const FileDescriptor& {
     return socket;
 }
+auto WorkerGroup::get_reader() -> PacketReader& {
+    return reader;
+}
+auto WorkerGroup::get_writer() -> PacketWriter& {
+    return writer;
+}
+auto WorkerGroup::get_bytes_sent() const -> uint64_t {
+    return writer.get_total();
+}
+auto WorkerGroup::get_bytes_received() const -> uint64_t {
+    return reader.get_total();
+}
+auto WorkerGroup::flush() -> bool {
+    return writer.flush(socket);
+}
+auto WorkerGroup::is_connecting() const -> bool {
+    return connecting;
+}
+auto WorkerGroup::set_connected() -> void {
+    connecting = false;
+    // the workers packet is sent from now on
+    handshake = steady_ns();
+}
+auto WorkerGroup::get_deadline() const -> std::optional<int64_t> {
+    return deadline;
+}
+auto WorkerGroup::is_ready() const -> bool {
+    return ready;
+}
+auto WorkerGroup::is_closed() const -> bool {
+    return closed;
+}
+auto WorkerGroup::set_closed() -> void {
+    closed = true;
+}
 auto WorkerGroup::is_busy() const -> bool {
-    return busy == workers;
+    return !ready || closed || jobs.size() >= capacity + prefetch;
 }
-auto WorkerGroup::decrement_busy() -> void {
-    ASSERT(busy != 0, "Decrement non-busy workers")
-    busy -= 1;
+auto WorkerGroup::is_idle() const -> bool {
+    return ready && !closed && jobs.size() < capacity;
 }
-auto WorkerGroup::increment_busy() -> void {
-    ASSERT(busy < workers, "Increment busy workers");
-    busy += 1;
+auto WorkerGroup::push_job(const uint64_t id, Job job) -> void {
+    ASSERT(!is_busy(), "Push job to busy workers");
+    jobs.emplace(id, std::move(job));
+}
+auto WorkerGroup::pop_job(const uint64_t id) -> Job {
+    const auto p = jobs.find(id);
+    if(p == jobs.end()) {
+        panic("Unknown job id ", id);
+    }
+    auto job = std::move(p->second);
+    jobs.erase(p);
+    return job;
+}
+auto WorkerGroup::find_job(const uint64_t id) const -> const Job* {
+    const auto p = jobs.find(id);
+    return p != jobs.end() ? &p->second : nullptr;
+}
+auto WorkerGroup::take_jobs() -> std::vector<Job> {
+    auto r = std::vector<Job>();
+    r.reserve(jobs.size());
+    for(auto& [id, job] : jobs) {
+        r.emplace_back(std::move(job));
+    }
+    jobs.clear();
+    return r;
 }
 auto WorkerGroup::get_workers() const -> uint32_t {
     return workers;
 }
+auto WorkerGroup::set_workers(const uint32_t count) -> void {
+    workers  = count;
+    capacity = count;
+    ready    = true;
+}
+auto WorkerGroup::get_capacity() const -> uint32_t {
+    return capacity;
+}
+auto WorkerGroup::set_capacity(const uint32_t count) -> void {
+    capacity = count;
+}
 auto WorkerGroup::get_busy() const -> uint32_t {
-    return busy;
-}
-WorkerGroup::WorkerGroup(uint32_t address, FileDescriptor socket) : address(address), socket(socket) {
-    do {
-        if(!this->socket.write(WorkerGroupMessage::WORKERS)) {
-            break;
-        }
-        if(const auto opt = this->socket.read<uint32_t>(); !opt.has_value()) {
-            break;
-        } else {
-            workers = *opt;
-        }
-        warn("Conected to new workers: ", address == 0 ? "local" : inet_ntoa({address}));
+    return jobs.size();
+}
+auto WorkerGroup::get_running() const -> uint32_t {
+    return std::min<uint32_t>(jobs.size(), capacity);
+}
+auto WorkerGroup::get_prefetched() const -> uint32_t {
+    return jobs.size() > capacity ? jobs.size() - capacity : 0;
+}
+auto WorkerGroup::is_revoking() const -> bool {
+    return revoking;
+}
+auto WorkerGroup::set_revoking(const bool flag) -> void {
+    revoking = flag;
+}
+auto WorkerGroup::is_watching_output() const -> bool {
+    return watching_output;
+}
+auto WorkerGroup::set_watching_output(const bool flag) -> void {
+    watching_output = flag;
+}
+auto WorkerGroup::add_consumed(const uint64_t bytes) -> void {
+    consumed += bytes;
+}
+auto WorkerGroup::take_consumed() -> uint64_t {
+    return std::exchange(consumed, 0);
+}
+auto WorkerGroup::get_consumed() const -> uint64_t {
+    return consumed;
+}
+auto WorkerGroup::set_clock(const int64_t remote, const int64_t received) -> void {
+    // local workers share the clock
+    if(address == 0) {
         return;
-    } while(0);
-    panic("Failed to get worker numbers");
+    }
+    // assume the reply was made halfway through the round trip
+    clock_offset = remote - (handshake + received) / 2;
+}
+auto WorkerGroup::to_local_time(const int64_t remote) const -> int64_t {
+    return remote - clock_offset;
+}
+auto WorkerGroup::intern_command(const uint64_t command) -> std::pair<uint32_t, bool> {
+    if(const auto p = templates.find(command); p != templates.end()) {
+        return {p->second, false};
+    }
+    // reuse slots in order, as the workers do
+    const auto slot = next_template;
+    next_template   = (next_template + 1) % MAX_TEMPLATES;
+    if(slot < template_commands.size()) {
+        templates.erase(template_commands[slot]);
+        template_commands[slot] = command;
+    } else {
+        template_commands.push_back(command);
+    }
+    templates.emplace(command, slot);
+    return {slot, true};
+}
+WorkerGroup::WorkerGroup(const uint32_t serial, uint32_t address, FileDescriptor socket, const uint32_t prefetch, const bool connecting, const std::optional<int64_t> deadline) : EventSource{EventSourceType::WORKER_GROUP}, serial(serial), address(address), prefetch(prefetch), connecting(connecting), deadline(deadline), socket(socket) {
+    // ask the number of workers, the answer is handled by the server
+    auto&      buffer = writer.get_buffer();
+    const auto packet = begin_packet(buffer, WorkerGroupMessage::WORKERS);
+    wire::append_fixed(buffer, PROTOCOL_VERSION);
+    finish_packet(buffer, packet);
+    handshake = steady_ns();
 }
 } // namespace xrun
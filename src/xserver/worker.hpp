@@ -1,57 +1,151 @@
 #pragma once
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "../fd.hpp"
+#include "../packet.hpp"
+#include "arena.hpp"
+#include "event.hpp"
 
 namespace xrun {
 struct Command {
-    std::string cwd;
-    std::string command;
+    std::string              cwd;
+    std::string              command;
+    std::vector<std::string> inputs;         // files the result depends on, for the cache
+    std::optional<uint64_t>  input_digest;   // of the paths and contents of inputs, hashed once by the cache
+    uint64_t                 id         = 0; // unique among received commands
+    uint64_t                 submission = 0; // xrun connection which sent it
 };
 
+using TimePoint = std::chrono::steady_clock::time_point;
+
+// kept small, millions of them may wait in the queue
 class Job {
   private:
-    std::shared_ptr<Command> command;
-    std::string              arg;
+    Rc<Command>             command;
+    ArenaString             arg;
+    std::optional<uint64_t> cache_key;
+    std::optional<uint32_t> node; // in the dependency graph of its submission
+    TimePoint               enqueued;
+    TimePoint               dispatched;
 
   public:
-    auto set_command(Command* c) -> void {
-        command.reset(c);
+    auto set_command(Rc<Command> c) -> void {
+        command = std::move(c);
     }
     auto set_command(const Job& o) -> void {
         command = o.command;
     }
-    auto get_command() const -> std::shared_ptr<Command> {
+    auto get_command() const -> const Rc<Command>& {
         return command;
     }
-    auto set_arg(const char* a) -> void {
-        arg = a;
+    auto set_arg(ArenaString a) -> void {
+        arg = std::move(a);
     }
-    auto get_arg() const -> const char* {
-        return arg.data();
+    auto get_arg() const -> std::string_view {
+        return arg.view();
     }
     auto has_arg() const -> bool {
         return !arg.empty();
     }
+    auto set_cache_key(const uint64_t key) -> void {
+        cache_key = key;
+    }
+    auto get_cache_key() const -> std::optional<uint64_t> {
+        return cache_key;
+    }
+    auto set_node(const uint32_t n) -> void {
+        node = n;
+    }
+    auto get_node() const -> std::optional<uint32_t> {
+        return node;
+    }
+    auto set_enqueued(const TimePoint time) -> void {
+        enqueued = time;
+    }
+    auto get_enqueued() const -> TimePoint {
+        return enqueued;
+    }
+    auto set_dispatched(const TimePoint time) -> void {
+        dispatched = time;
+    }
+    auto get_dispatched() const -> TimePoint {
+        return dispatched;
+    }
     Job(){};
 };
 
-class WorkerGroup {
+class WorkerGroup : public EventSource {
   private:
-    uint32_t       address;
-    uint32_t       workers;
-    uint32_t       busy = 0;
-    FileDescriptor socket;
+    uint32_t                          serial; // unique among connections
+    uint32_t                          address;
+    uint32_t                          workers  = 0;
+    uint32_t                          capacity = 0; // slots the workers are going to use
+    uint32_t                          prefetch;
+    bool                              connecting;              // the socket is not connected yet
+    bool                              ready           = false; // received the number of workers
+    bool                              closed          = false;
+    bool                              revoking        = false;
+    bool                              watching_output = false;
+    std::unordered_map<uint64_t, Job> jobs;
+    uint64_t                          consumed     = 0; // output bytes not yet given back as credit
+    int64_t                           handshake;        // when the workers packet was sent
+    std::optional<int64_t>            deadline;         // of the connection and the handshake, nullopt if none
+    int64_t                           clock_offset = 0; // clock of the workers minus ours
+    FileDescriptor                    socket;
+    PacketReader                      reader;
+    PacketWriter                      writer;
+
+    // commands registered on the connection
+    std::unordered_map<uint64_t, uint32_t> templates;         // command id -> slot
+    std::vector<uint64_t>                  template_commands; // slot -> command id
+    uint32_t                               next_template = 0;
 
   public:
+    auto get_serial() const -> uint32_t;
     auto get_address() const -> const uint32_t;
     auto get_fd() const -> const FileDescriptor&;
+    auto get_reader() -> PacketReader&;
+    auto get_writer() -> PacketWriter&;
+    auto get_bytes_sent() const -> uint64_t;
+    auto get_bytes_received() const -> uint64_t;
+    auto flush() -> bool;
+    auto is_connecting() const -> bool;
+    auto set_connected() -> void;
+    auto get_deadline() const -> std::optional<int64_t>;
+    auto is_ready() const -> bool;
+    auto is_closed() const -> bool;
+    auto set_closed() -> void;
     auto is_busy() const -> bool;
-    auto decrement_busy() -> void;
-    auto increment_busy() -> void;
+    auto is_idle() const -> bool;
+    auto push_job(uint64_t id, Job job) -> void;
+    auto pop_job(uint64_t id) -> Job;
+    auto find_job(uint64_t id) const -> const Job*;
+    auto take_jobs() -> std::vector<Job>;
     auto get_workers() const -> uint32_t;
+    auto set_workers(uint32_t count) -> void;
+    auto get_capacity() const -> uint32_t;
+    auto set_capacity(uint32_t count) -> void;
     auto get_busy() const -> uint32_t;
-    WorkerGroup(uint32_t address, FileDescriptor socket);
+    auto get_running() const -> uint32_t;
+    auto get_prefetched() const -> uint32_t;
+    auto is_revoking() const -> bool;
+    auto set_revoking(bool flag) -> void;
+    auto is_watching_output() const -> bool;
+    auto set_watching_output(bool flag) -> void;
+    auto add_consumed(uint64_t bytes) -> void;
+    auto take_consumed() -> uint64_t;
+    auto get_consumed() const -> uint64_t;
+    // estimates the clock offset from the reply to the workers packet
+    auto set_clock(int64_t remote, int64_t received) -> void;
+    // converts a timestamp of the workers to ours
+    auto to_local_time(int64_t remote) const -> int64_t;
+    // returns the template slot of the command, and true if it has to be sent with the job
+    auto intern_command(uint64_t command) -> std::pair<uint32_t, bool>;
+    WorkerGroup(uint32_t serial, uint32_t address, FileDescriptor socket, uint32_t prefetch, bool connecting, std::optional<int64_t> deadline);
 };
 } // namespace xrun
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../fd.hpp"
+#include "admission.hpp"
+
+namespace xrun {
+namespace {
+auto read_small_file(const char* const path, char (&buf)[256]) -> bool {
+    const auto fd = FileDescriptor(open(path, O_RDONLY | O_CLOEXEC));
+    if(fd < 0) {
+        return false;
+    }
+    const auto n = read(fd, buf, sizeof(buf) - 1);
+    if(n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    return true;
+}
+// "some avg10=1.23 avg60=..." is the first line, nullopt if PSI is not available
+auto read_pressure(const char* const path) -> std::optional<double> {
+    char buf[256];
+    if(!read_small_file(path, buf)) {
+        return std::nullopt;
+    }
+    const auto p = std::strstr(buf, "some avg10=");
+    if(p == nullptr) {
+        return std::nullopt;
+    }
+    return std::strtod(p + std::strlen("some avg10="), nullptr);
+}
+auto read_load() -> std::optional<double> {
+    char buf[256];
+    if(!read_small_file("/proc/loadavg", buf)) {
+        return std::nullopt;
+    }
+    return std::strtod(buf, nullptr);
+}
+} // namespace
+auto Admission::is_enabled() const -> bool {
+    return limits.pressure.has_value() || limits.load.has_value();
+}
+auto Admission::update() -> bool {
+    constexpr const char* RESOURCES[] = {"cpu", "memory", "io"};
+
+    // without slots there is nothing to throttle, and backing off would wrap around
+    if(capacity == 0) {
+        return false;
+    }
+
+    // over: some reading exceeds its limit, calm: every reading is below half of its limit
+    auto over = false, calm = true;
+    reason.clear();
+    const auto check = [&](const char* const name, const std::optional<double> value, const double limit) {
+        if(!value.has_value()) {
+            return;
+        }
+        over |= *value > limit;
+        calm &= *value < limit / 2;
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s%s %.2f", reason.empty() ? "" : ", ", name, *value);
+        reason += buf;
+    };
+    if(limits.pressure.has_value()) {
+        for(const auto resource : RESOURCES) {
+            const auto path = std::string("/proc/pressure/") + resource;
+            check(resource, read_pressure(path.data()), *limits.pressure);
+        }
+    }
+    if(limits.load.has_value()) {
+        check("load", read_load(), *limits.load);
+    }
+
+    // back off quickly, recover one slot at a time
+    const auto prev = capacity;
+    if(over) {
+        capacity -= std::max(capacity / 4, uint32_t(1));
+        capacity = std::max(capacity, uint32_t(1));
+    } else if(calm) {
+        capacity = std::min(capacity + 1, slots);
+    }
+    return capacity != prev;
+}
+auto Admission::get_capacity() const -> uint32_t {
+    return capacity;
+}
+auto Admission::get_reason() const -> const std::string& {
+    return reason;
+}
+Admission::Admission(AdmissionLimits limits, const uint32_t slots) : limits(limits), slots(slots), capacity(slots) {}
+} // namespace xrun
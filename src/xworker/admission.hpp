@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace xrun {
+struct AdmissionLimits {
+    std::optional<double> pressure; // percentage of "some" avg10 in /proc/pressure/{cpu,memory,io}
+    std::optional<double> load;     // 1 minute load average
+};
+
+// number of slots to use, shrinks while the host is under pressure
+class Admission {
+  private:
+    AdmissionLimits limits;
+    uint32_t        slots;
+    uint32_t        capacity;
+    std::string     reason; // readings of the last update
+
+  public:
+    auto is_enabled() const -> bool;
+    // samples the host, returns true if the capacity changed
+    auto update() -> bool;
+    auto get_capacity() const -> uint32_t;
+    auto get_reason() const -> const std::string&;
+
+    Admission(AdmissionLimits limits, uint32_t slots);
+};
+} // namespace xrun
@@ -57,14 +57,23 @@ auto parse_replace(const char* const arg) -> ReplaceString {
 }
 } // namespace
 auto parse_args(const int argc, const char* const argv[]) -> Args {
-    int  local = 0, help = 0;
+    int  local = 0, zygote = 0, help = 0;
     auto result = Args();
 
-    const auto   optstring  = "j:lr:h";
+    const auto   optstring  = "j:lr:s:L:zo:d:n:p:a:m:h";
     const option longopts[] = {
         {"jobs", required_argument, 0, 'j'},
         {"local", no_argument, &local, 1},
         {"replace", required_argument, 0, 'r'},
+        {"shell", required_argument, 0, 's'},
+        {"launcher", required_argument, 0, 'L'},
+        {"zygote", no_argument, &zygote, 1},
+        {"output-limit", required_argument, 0, 'o'},
+        {"log-dir", required_argument, 0, 'd'},
+        {"name", required_argument, 0, 'n'},
+        {"max-pressure", required_argument, 0, 'p'},
+        {"max-load", required_argument, 0, 'a'},
+        {"measure-launch", required_argument, 0, 'm'},
         {"help", required_argument, &help, 1},
         {0, 0, 0, 0},
     };
@@ -82,14 +91,46 @@ auto parse_args(const int argc, const char* const argv[]) -> Args {
         case 'r':
             result.replace.emplace_back(parse_replace(optarg));
             break;
+        case 's':
+            result.shell = optarg;
+            break;
+        case 'L':
+            if(const auto mode = parse_launch_mode(optarg); mode.has_value()) {
+                result.launcher = *mode;
+            } else {
+                panic("Unknown launcher ", optarg);
+            }
+            break;
+        case 'z':
+            zygote = 1;
+            break;
+        case 'o':
+            result.output_limit = std::stoul(optarg);
+            break;
+        case 'd':
+            result.log_dir = optarg;
+            break;
+        case 'n':
+            result.name = optarg;
+            break;
+        case 'p':
+            result.admission.pressure = std::stod(optarg);
+            break;
+        case 'a':
+            result.admission.load = std::stod(optarg);
+            break;
+        case 'm':
+            result.measure_launch = std::stoul(optarg);
+            break;
         case 'h':
             help = 1;
             break;
         }
     }
 
-    result.local = local != 0;
-    result.help  = help != 0;
+    result.local  = local != 0;
+    result.zygote = zygote != 0;
+    result.help   = help != 0;
 
     return result;
 }
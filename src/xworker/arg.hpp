@@ -3,6 +3,9 @@
 #include <string>
 #include <vector>
 
+#include "admission.hpp"
+#include "launcher.hpp"
+
 namespace xrun {
 struct ReplaceString {
     std::string from;
@@ -16,6 +19,14 @@ struct Args {
     std::optional<int>         jobs;
     bool                       local = false;
     std::vector<ReplaceString> replace;
+    std::string                shell    = "/usr/bin/zsh";
+    LaunchMode                 launcher = LaunchMode::LOGIN;
+    bool                       zygote   = false;
+    std::optional<int>         measure_launch;
+    size_t                     output_limit = process::CaptureOptions().limit;
+    const char*                log_dir      = nullptr;
+    std::string                name         = "xrun";
+    AdmissionLimits            admission;
     bool                       help = false;
 };
 
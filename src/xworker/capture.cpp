@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture.hpp"
+
+namespace process {
+namespace {
+// xworker is single threaded, share one buffer for every stream
+char read_buffer[64 * 1024];
+} // namespace
+auto Capture::append(const char* data, size_t len) -> void {
+    if(spill != -1) {
+        for(auto written = size_t(0); written < len;) {
+            const auto n = write(spill, data + written, len - written);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                // give up the full log, the excerpt is still available
+                ::close(spill);
+                spill = -1;
+                break;
+            }
+            written += n;
+        }
+    }
+    total += len;
+
+    if(head.size() < limit) {
+        const auto n = std::min(len, limit - head.size());
+        head.append(data, n);
+        data += n;
+        len -= n;
+    }
+    if(len >= limit) {
+        tail.assign(data + len - limit, limit);
+        tail_pos = 0;
+        return;
+    }
+    while(len > 0) {
+        if(tail.size() < limit) {
+            const auto n = std::min(len, limit - tail.size());
+            tail.append(data, n);
+            data += n;
+            len -= n;
+            continue;
+        }
+        const auto n = std::min(len, limit - tail_pos);
+        std::memcpy(tail.data() + tail_pos, data, n);
+        tail_pos = (tail_pos + n) % limit;
+        data += n;
+        len -= n;
+    }
+}
+auto Capture::start(const CaptureOptions& options) -> bool {
+    limit   = options.limit;
+    log_dir = options.log_dir;
+    if(log_dir == nullptr) {
+        return true;
+    }
+    spill = ::open(log_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0644);
+    return spill != -1;
+}
+auto Capture::read(const int fd, size_t limit, std::vector<uint8_t>* const forward) -> bool {
+    while(limit > 0) {
+        const auto n = ::read(fd, read_buffer, std::min(sizeof(read_buffer), limit));
+        if(n > 0) {
+            append(read_buffer, n);
+            if(forward != nullptr) {
+                forward->insert(forward->end(), read_buffer, read_buffer + n);
+            }
+            limit -= n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+auto Capture::keep(const std::string& name) -> std::string {
+    if(spill == -1 || total == 0) {
+        return {};
+    }
+    // linkat() with AT_EMPTY_PATH needs a capability, go through procfs instead
+    const auto proc = "/proc/self/fd/" + std::to_string(spill);
+    auto       path = std::string(log_dir) + "/" + name;
+    if(linkat(AT_FDCWD, proc.data(), AT_FDCWD, path.data(), AT_SYMLINK_FOLLOW) != 0) {
+        return {};
+    }
+    return path;
+}
+auto Capture::get_head() const -> const std::string& {
+    return head;
+}
+auto Capture::get_tail() const -> std::string {
+    return tail.substr(tail_pos) + tail.substr(0, tail_pos);
+}
+auto Capture::get_total() const -> size_t {
+    return total;
+}
+Capture::Capture(Capture&& o) {
+    *this = std::move(o);
+}
+auto Capture::operator=(Capture&& o) -> Capture& {
+    if(spill != -1) {
+        ::close(spill);
+    }
+    limit    = o.limit;
+    head     = std::move(o.head);
+    tail     = std::move(o.tail);
+    tail_pos = std::exchange(o.tail_pos, 0);
+    total    = std::exchange(o.total, 0);
+    spill    = std::exchange(o.spill, -1);
+    log_dir  = o.log_dir;
+    o.head.clear();
+    o.tail.clear();
+    return *this;
+}
+Capture::~Capture() {
+    if(spill != -1) {
+        ::close(spill);
+    }
+}
+} // namespace process
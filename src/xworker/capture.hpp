@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace process {
+struct CaptureOptions {
+    size_t      limit   = 32 * 1024; // bytes kept from each of the head and the tail
+    const char* log_dir = nullptr;   // the full stream is spilled to an unnamed file here, if not null
+};
+
+// keeps the head and the tail of a stream in memory, the middle is only in the spill file
+class Capture {
+  private:
+    size_t      limit = CaptureOptions().limit;
+    std::string head;
+    std::string tail;         // ring buffer after it reached the limit
+    size_t      tail_pos = 0; // oldest byte in the ring
+    size_t      total    = 0;
+    int         spill    = -1;
+    const char* log_dir  = nullptr;
+
+    auto append(const char* data, size_t len) -> void;
+
+  public:
+    auto start(const CaptureOptions& options) -> bool;
+    // reads fd until it would block or limit bytes are read, returns false on eof or error
+    // the data is also appended to forward if given
+    auto read(int fd, size_t limit = SIZE_MAX, std::vector<uint8_t>* forward = nullptr) -> bool;
+    // links the spill file as name in the log directory, returns the path or empty string on failure
+    auto keep(const std::string& name) -> std::string;
+    auto get_head() const -> const std::string&;
+    auto get_tail() const -> std::string;
+    auto get_total() const -> size_t;
+
+    Capture() = default;
+    Capture(Capture&& o);
+    auto operator=(Capture&& o) -> Capture&;
+    ~Capture();
+};
+} // namespace process
@@ -0,0 +1,212 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../error.hpp"
+#include "launcher.hpp"
+
+namespace xrun {
+namespace {
+constexpr auto ENVIRONMENT_MARKER = std::string_view("\nXRUN_ENVIRONMENT_BEGIN\n");
+
+// splits a command into words if it can be executed without shell
+// only single quotes are understood, since xserver quotes arguments with them
+auto split_command(const std::string& command) -> std::optional<std::vector<std::string>> {
+    constexpr auto metachars = std::string_view("\\\"$`;&|<>()*?[]{}~#!\n");
+
+    auto words   = std::vector<std::string>();
+    auto word    = std::string();
+    auto in_word = false;
+    for(auto i = size_t(0); i < command.size(); i += 1) {
+        const auto c = command[i];
+        if(c == '\'') {
+            const auto end = command.find('\'', i + 1);
+            if(end == std::string::npos) {
+                return std::nullopt;
+            }
+            word.append(command, i + 1, end - i - 1);
+            in_word = true;
+            i       = end;
+        } else if(c == ' ' || c == '\t') {
+            if(in_word) {
+                words.emplace_back(std::move(word));
+                word.clear();
+                in_word = false;
+            }
+        } else if(metachars.find(c) != std::string_view::npos || (c == '=' && (!in_word || words.empty()))) {
+            // '=' makes an assignment in the first word, or a path expansion of zsh at the beginning of words
+            return std::nullopt;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if(in_word) {
+        words.emplace_back(std::move(word));
+    }
+    if(words.empty()) {
+        return std::nullopt;
+    }
+    return words;
+}
+} // namespace
+auto Launcher::capture_environment() -> bool {
+    const auto command = shell + " -l -c 'echo; echo XRUN_ENVIRONMENT_BEGIN; env -0'";
+    const auto pipe    = popen(command.data(), "r");
+    if(pipe == NULL) {
+        return false;
+    }
+    auto output = std::string();
+    {
+        char buf[4096];
+        auto n = size_t();
+        while((n = fread(buf, 1, sizeof(buf), pipe)) > 0) {
+            output.append(buf, n);
+        }
+    }
+    if(pclose(pipe) != 0) {
+        return false;
+    }
+
+    // login scripts may print something, so skip until the marker
+    auto pos = output.find(ENVIRONMENT_MARKER);
+    if(pos == std::string::npos) {
+        return false;
+    }
+    pos += ENVIRONMENT_MARKER.size();
+    while(pos < output.size()) {
+        auto end = output.find('\0', pos);
+        if(end == std::string::npos) {
+            end = output.size();
+        }
+        if(const auto entry = output.substr(pos, end - pos); entry.find('=') != std::string::npos) {
+            environment.emplace_back(std::move(entry));
+        }
+        pos = end + 1;
+    }
+    for(const auto& e : environment) {
+        envp.emplace_back(e.data());
+        if(e.starts_with("PATH=")) {
+            for(auto p = size_t(5); p <= e.size();) {
+                auto end = e.find(':', p);
+                if(end == std::string::npos) {
+                    end = e.size();
+                }
+                path.emplace_back(end == p ? std::string(".") : e.substr(p, end - p));
+                p = end + 1;
+            }
+        }
+    }
+    envp.emplace_back(nullptr);
+    return true;
+}
+auto Launcher::resolve(const std::string& name) -> const std::string* {
+    if(name.find('/') != std::string::npos) {
+        return &name;
+    }
+    if(const auto p = resolved.find(name); p != resolved.end()) {
+        return &p->second;
+    }
+    for(const auto& dir : path) {
+        auto candidate = dir + "/" + name;
+        auto st        = (struct stat){};
+        if(stat(candidate.data(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.data(), X_OK) == 0) {
+            return &resolved.emplace(name, std::move(candidate)).first->second;
+        }
+    }
+    // not a program, maybe a shell builtin or function
+    return nullptr;
+}
+auto Launcher::open(process::Process& process, std::optional<process::Zygote>& zygote, const std::string& command, const char* const working_dir, const std::array<bool, 3> open_pipe) -> process::OpenResult {
+    const auto login      = mode == LaunchMode::LOGIN;
+    const auto shell_argv = login ? std::array<const char*, 5>{shell.data(), "-l", "-c", command.data(), nullptr}
+                                  : std::array<const char*, 5>{shell.data(), "-c", command.data(), nullptr, nullptr};
+    if(mode == LaunchMode::DIRECT) {
+        if(const auto words = split_command(command); words.has_value()) {
+            if(const auto exe = resolve(words->front()); exe != nullptr) {
+                auto argv = std::vector<const char*>();
+                argv.reserve(words->size() + 1);
+                for(const auto& w : *words) {
+                    argv.emplace_back(w.data());
+                }
+                argv.emplace_back(nullptr);
+                // the shell takes over if exec fails, e.g. the program was removed
+                return process.open(exe->data(), argv.data(), envp.data(), working_dir, open_pipe, shell_argv.data());
+            }
+        }
+    }
+    if(this->zygote && command.find('\n') == std::string::npos) {
+        if(!zygote.has_value()) {
+            zygote.emplace();
+        }
+        auto ok = zygote->is_alive();
+        if(!ok) {
+            const auto argv = login ? std::array<const char*, 5>{shell.data(), "-l", "-c", process::Zygote::script, nullptr}
+                                    : std::array<const char*, 5>{shell.data(), "-c", process::Zygote::script, nullptr, nullptr};
+            ok              = zygote->open(shell.data(), argv.data(), login ? nullptr : envp.data()).message == nullptr;
+        }
+        // spawn normally if the zygote is not available
+        if(ok && zygote->run(working_dir, command).message == nullptr) {
+            return {};
+        }
+    }
+    return process.open(shell.data(), shell_argv.data(), login ? nullptr : envp.data(), working_dir, open_pipe);
+}
+Launcher::Launcher(const LaunchMode mode, std::string shell, const bool zygote) : mode(mode), shell(std::move(shell)), zygote(zygote) {
+    if(mode != LaunchMode::LOGIN && !capture_environment()) {
+        panic("Failed to capture login environment of ", this->shell);
+    }
+}
+
+auto parse_launch_mode(const char* const str) -> std::optional<LaunchMode> {
+    if(std::strcmp(str, "login") == 0) {
+        return LaunchMode::LOGIN;
+    } else if(std::strcmp(str, "env") == 0) {
+        return LaunchMode::ENV;
+    } else if(std::strcmp(str, "direct") == 0) {
+        return LaunchMode::DIRECT;
+    }
+    return std::nullopt;
+}
+auto measure_launchers(const std::string& shell, const int count) -> void {
+    struct Variant {
+        LaunchMode  mode;
+        bool        zygote;
+        const char* name;
+        const char* command;
+    };
+    // "true" is executed directly in direct mode, so give it something needs a shell
+    constexpr Variant variants[] = {
+        {LaunchMode::LOGIN, false, "login", "true"},
+        {LaunchMode::ENV, false, "env", "true"},
+        {LaunchMode::DIRECT, false, "direct", "true"},
+        {LaunchMode::DIRECT, false, "direct(shell)", "true;"},
+        {LaunchMode::LOGIN, true, "login+zygote", "true"},
+        {LaunchMode::ENV, true, "env+zygote", "true"},
+        {LaunchMode::DIRECT, true, "direct(shell)+zygote", "true;"},
+    };
+    print("Spawn cost of \"true\", ", count, " times each");
+    for(const auto& v : variants) {
+        auto       launcher = Launcher(v.mode, shell, v.zygote);
+        auto       zygote   = std::optional<process::Zygote>();
+        const auto begin    = std::chrono::steady_clock::now();
+        for(auto i = 0; i < count; i += 1) {
+            auto process = process::Process();
+            if(const auto r = launcher.open(process, zygote, v.command, nullptr, {}); r.message != nullptr) {
+                panic("Failed to open process: ", r.message, "(", r.error_num, ")");
+            }
+            if(zygote.has_value() && zygote->is_running()) {
+                zygote->finish();
+            } else {
+                process.close();
+            }
+        }
+        const auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin);
+        print("    ", v.name, "\t", elapsed.count() / count, " us/job");
+    }
+}
+} // namespace xrun
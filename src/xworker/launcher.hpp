@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "process.hpp"
+#include "zygote.hpp"
+
+namespace xrun {
+enum class LaunchMode {
+    LOGIN,  // shell -l -c command
+    ENV,    // shell -c command, with the login environment captured at startup
+    DIRECT, // exec simple commands without shell, others are same as ENV
+};
+
+class Launcher {
+  private:
+    LaunchMode                                   mode;
+    std::string                                  shell;
+    bool                                         zygote;
+    std::vector<std::string>                     environment;
+    std::vector<const char*>                     envp;
+    std::vector<std::string>                     path;
+    std::unordered_map<std::string, std::string> resolved;
+
+    auto capture_environment() -> bool;
+    auto resolve(const std::string& name) -> const std::string*;
+
+  public:
+    // commands which need a shell are sent to the zygote if enabled, check zygote.is_running() to know which one was used
+    auto open(process::Process& process, std::optional<process::Zygote>& zygote, const std::string& command, const char* working_dir, std::array<bool, 3> open_pipe) -> process::OpenResult;
+
+    Launcher(LaunchMode mode, std::string shell, bool zygote = false);
+};
+
+auto parse_launch_mode(const char* str) -> std::optional<LaunchMode>;
+auto measure_launchers(const std::string& shell, int count) -> void;
+} // namespace xrun
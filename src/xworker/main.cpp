@@ -1,5 +1,6 @@
 #include <cstdio>
 
+#include "launcher.hpp"
 #include "workers.hpp"
 
 const static auto HELP =
@@ -13,6 +14,24 @@ Options:
                                 g  Replace all
                                 c  Command only
                                 w  Working directory only
+    -s --shell PATH         Shell to run commands (default: /usr/bin/zsh)
+    -L --launcher MODE      How to launch commands
+                            Modes:
+                                login   Run "shell -l -c command" (default)
+                                env     Capture the login environment once,
+                                        then run "shell -c command" with it
+                                direct  Same as env, but execute simple commands
+                                        without shell
+    -z --zygote             Keep a warm shell per job slot and fork commands
+                            which need a shell from it
+    -o --output-limit N     Report first and last N bytes of output of failed jobs
+                            (default: 32768)
+    -d --log-dir DIR        Save full output of failed jobs in DIR
+    -n --name NAME          Name of the socket for local server (default: xrun)
+    -p --max-pressure PCT   Use fewer slots while cpu, memory or io pressure
+                            (PSI "some" avg10) is above PCT percent
+    -a --max-load LOAD      Use fewer slots while 1 minute load average is above LOAD
+    -m --measure-launch N   Measure spawn cost of each launcher with N runs and exit
     -h --help               Print this help
 )";
 int main(const int argc, const char* const argv[]) {
@@ -21,6 +40,10 @@ int main(const int argc, const char* const argv[]) {
         printf("%s\n", HELP);
         return 0;
     }
+    if(args.measure_launch.has_value()) {
+        xrun::measure_launchers(args.shell, *args.measure_launch);
+        return 0;
+    }
     xrun::WorkerGroup().run(args);
     return 0;
 }
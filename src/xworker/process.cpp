@@ -1,69 +1,113 @@
 #include <cerrno>
+#include <csignal>
 #include <string>
-#include <vector>
 
-#include <poll.h>
-#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <wait.h>
 
 #include "process.hpp"
 
 namespace process {
-auto Process::open(const char* shell, const char* command, const char* working_dir, const std::array<bool, 3> open_pipe) -> OpenResult {
+namespace {
+auto to_usage(const rusage& rusage) -> Usage {
+    auto usage                 = Usage();
+    usage.user_us              = rusage.ru_utime.tv_sec * 1000000 + rusage.ru_utime.tv_usec;
+    usage.system_us            = rusage.ru_stime.tv_sec * 1000000 + rusage.ru_stime.tv_usec;
+    usage.max_rss_kb           = rusage.ru_maxrss;
+    usage.minor_faults         = rusage.ru_minflt;
+    usage.major_faults         = rusage.ru_majflt;
+    usage.voluntary_switches   = rusage.ru_nvcsw;
+    usage.involuntary_switches = rusage.ru_nivcsw;
+    return usage;
+}
+} // namespace
+auto Process::open(const char* const path, const char* const* argv, const char* const* envp, const char* working_dir, const std::array<bool, 3> open_pipe, const char* const* fallback) -> OpenResult {
+    // every fd is close-on-exec, so that other jobs do not inherit them
     int fds[3][2];
     for(auto i = 0; i < 3; i += 1) {
-        if(!open_pipe[i]) {
-            continue;
-        }
-        if(pipe(fds[i]) < 0) {
-            for(auto j = 0; j < i; ++j) {
-                if(!open_pipe[i]) {
-                    continue;
-                }
-                ::close(fds[j][0]);
-                ::close(fds[j][1]);
+        if(open_pipe[i]) {
+            if(pipe2(fds[i], O_CLOEXEC) == 0) {
+                continue;
+            }
+        } else {
+            const auto null = ::open("/dev/null", (i == 0 ? O_RDONLY : O_WRONLY) | O_CLOEXEC);
+            if(null != -1) {
+                fds[i][0] = null;
+                fds[i][1] = -1;
+                continue;
             }
-            return {.message = "Failed to create pipe", .error_num = errno};
         }
+        const auto error = errno;
+        for(auto j = 0; j < i; j += 1) {
+            ::close(fds[j][0]);
+            ::close(fds[j][1]);
+        }
+        return {.message = "Failed to create pipe", .error_num = error};
     }
-    const auto pid = vfork();
-    if(pid < 0) {
+    const auto close_fds = [&fds]() {
         for(auto i = 0; i < 3; i += 1) {
-            if(!open_pipe[i]) {
-                continue;
-            }
             ::close(fds[i][0]);
             ::close(fds[i][1]);
         }
-        return {.message = "Failed to fork process", .error_num = errno};
+    };
+    const auto pid = vfork();
+    if(pid < 0) {
+        const auto error = errno;
+        close_fds();
+        return {.message = "Failed to fork process", .error_num = error};
     } else if(pid != 0) {
+        const auto fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+        if(fd < 0) {
+            const auto error = errno;
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            close_fds();
+            return {.message = "Failed to open pidfd", .error_num = error};
+        }
         this->pid = pid;
-        for(auto i = 0; i < 3; ++i) {
-            if(open_pipe[i]) {
-                pipes[i] = fdopen(fds[i][i == 0 ? 1 : 0], i == 0 ? "w" : "r");
-                ::close(fds[i][i == 0 ? 0 : 1]);
+        pidfd     = fd;
+        for(auto i = 0; i < 3; i += 1) {
+            if(!open_pipe[i]) {
+                ::close(fds[i][0]);
+                continue;
+            }
+            // keep the parent side
+            pipes[i] = fds[i][i == 0 ? 1 : 0];
+            ::close(fds[i][i == 0 ? 0 : 1]);
+            if(i != 0) {
+                fcntl(pipes[i], F_SETFL, fcntl(pipes[i], F_GETFL) | O_NONBLOCK);
             }
         }
-        output_notify    = eventfd(0, 0);
-        output_collector = std::thread(&Process::collect_outputs, this);
         return {};
     } else {
-        for(auto i = 0; i < 3; ++i) {
-            dup2(fds[i][i == 0 ? 0 : 1], i);
-            ::close(fds[i][0]);
-            ::close(fds[i][1]);
+        for(auto i = 0; i < 3; i += 1) {
+            dup2(open_pipe[i] ? fds[i][i == 0 ? 0 : 1] : fds[i][0], i);
         }
+        // xworker ignores SIGPIPE, and ignored signals survive exec
+        signal(SIGPIPE, SIG_DFL);
         if(working_dir != nullptr) {
-            chdir(working_dir);
             if(chdir(working_dir) == -1) {
                 _exit(-1);
             }
         }
-        execl(shell, shell, "-l", "-c", command, NULL);
-        _exit(0);
+        const auto env = envp != nullptr ? const_cast<char* const*>(envp) : environ;
+        execve(path, const_cast<char* const*>(argv), env);
+        if(fallback != nullptr) {
+            execve(fallback[0], const_cast<char* const*>(fallback), env);
+        }
+        _exit(127);
     }
 }
+auto Process::read_output(const int stream, const size_t limit, std::vector<uint8_t>* const forward) -> bool {
+    const auto fd = pipes[stream];
+    if(fd == -1) {
+        return false;
+    }
+    return outputs[stream - 1].read(fd, limit, forward);
+}
 auto Process::close(const bool force) -> CloseResult {
     if(force) {
         if(kill(pid, SIGKILL) == -1) {
@@ -71,61 +115,36 @@ auto Process::close(const bool force) -> CloseResult {
         }
     }
 
-    int status;
-    waitpid(pid, &status, 0);
+    int  status;
+    auto rusage = ::rusage();
+    wait4(pid, &status, 0, &rusage);
 
-    {
-        int v = 1;
-        write(output_notify, &v, sizeof(int));
+    // take what is left in the pipes, but do not wait for descendants holding them
+    for(auto i = 1; i < 3; i += 1) {
+        read_output(i);
     }
-    output_collector.join();
-    ::close(output_notify);
-
-    for(auto i = 0; i < 3; ++i) {
-        if(pipes[i] != nullptr) {
-            fclose(pipes[i]);
+    for(auto i = 0; i < 3; i += 1) {
+        if(pipes[i] != -1) {
+            ::close(pipes[i]);
+            pipes[i] = -1;
         }
     }
+    ::close(pidfd);
+    pidfd = -1;
+
     const bool exitted = WIFEXITED(status);
-    return {{exitted ? ExitReason::Exit : ExitReason::Signal, exitted ? WEXITSTATUS(status) : WTERMSIG(status)}, std::move(outputs[0]), std::move(outputs[1])};
-}
-auto Process::collect_outputs() -> void {
-    std::vector<pollfd> fds;
-    if(pipes[1] != nullptr) {
-        fds.emplace_back(pollfd{.fd = fileno(pipes[1]), .events = POLLIN});
-    }
-    if(pipes[2] != nullptr) {
-        fds.emplace_back(pollfd{.fd = fileno(pipes[2]), .events = POLLIN});
-    }
-    fds.emplace_back(pollfd{.fd = output_notify, .events = POLLIN});
-    while(true) {
-        if(poll(fds.data(), fds.size(), -1) == -1) {
-            // poll error
-            return;
-        }
-        for(const auto& fd : fds) {
-            if(fd.revents & POLLHUP) {
-                // target process is exitted
-                return;
-            }
-            if(!(fd.revents & POLLIN)) {
-                continue;
-            }
-            if(fd.fd == fileno(pipes[1])) {
-                char buf[256] = {};
-                read(fds[0].fd, buf, 256);
-                outputs[0] += buf;
-            } else if(fd.fd == fileno(pipes[2])) {
-                char buf[256] = {};
-                read(fds[1].fd, buf, 256);
-                outputs[1] += buf;
-            } else if(fd.fd == output_notify) {
-                return;
-            }
-        }
-    }
+    return {{exitted ? ExitReason::Exit : ExitReason::Signal, exitted ? WEXITSTATUS(status) : WTERMSIG(status)}, std::move(outputs[0]), std::move(outputs[1]), to_usage(rusage)};
 }
 auto Process::get_pid() const -> pid_t {
     return pid;
 }
+auto Process::get_pidfd() const -> int {
+    return pidfd;
+}
+auto Process::get_pipe(const int stream) const -> int {
+    return pipes[stream];
+}
+auto Process::get_capture(const int stream) -> Capture& {
+    return outputs[stream - 1];
+}
 } // namespace process
@@ -1,26 +1,36 @@
 #pragma once
+#include <array>
 #include <cstdio>
-#include <thread>
+#include <string>
 
 #include <unistd.h>
 
+#include "capture.hpp"
+
 namespace process {
 struct OpenResult;
 struct CloseResult;
 struct ExitStatus;
 class Process {
   private:
-    pid_t       pid;
-    std::FILE*  pipes[3] = {nullptr};
-    std::thread output_collector;
-    std::string outputs[2];
-    int         output_notify;
-    auto        collect_outputs() -> void;
+    pid_t       pid      = -1;
+    int         pidfd    = -1; // readable when the process exits
+    int         pipes[3] = {-1, -1, -1};
+    Capture     outputs[2];
 
   public:
-    auto open(const char* shell, const char* command, const char* working_dir = nullptr, std::array<bool, 3> open_pipe = {}) -> OpenResult;
+    // envp == nullptr inherits the environment
+    // fallback(argv[0] is its path) is executed instead if path could not be executed
+    auto open(const char* path, const char* const* argv, const char* const* envp, const char* working_dir = nullptr, std::array<bool, 3> open_pipe = {}, const char* const* fallback = nullptr) -> OpenResult;
+    // reads available data of stdout(1) or stderr(2) without blocking, returns false on eof
+    // see Capture::read() for limit and forward
+    auto read_output(int stream, size_t limit = SIZE_MAX, std::vector<uint8_t>* forward = nullptr) -> bool;
+    // waits for the process, so call this after pidfd became readable
     auto close(bool force = false) -> CloseResult;
     auto get_pid() const -> pid_t;
+    auto get_pidfd() const -> int;
+    auto get_pipe(int stream) const -> int;
+    auto get_capture(int stream) -> Capture&;
 
     Process() = default;
 };
@@ -40,10 +50,22 @@ struct ExitStatus {
     int        code;
 };
 
+// resources consumed by a command and its waited descendants
+struct Usage {
+    int64_t user_us              = 0;
+    int64_t system_us            = 0;
+    int64_t max_rss_kb           = 0;
+    int64_t minor_faults         = 0;
+    int64_t major_faults         = 0;
+    int64_t voluntary_switches   = 0;
+    int64_t involuntary_switches = 0;
+};
+
 struct CloseResult {
     ExitStatus  status;
-    std::string out;
-    std::string err;
+    Capture     out;
+    Capture     err;
+    Usage       usage;
     const char* message = nullptr;
 };
 } // namespace process
@@ -1,76 +1,87 @@
 #include <cstring>
+#include <ctime>
 
-#include "../byte.hpp"
 #include "../error.hpp"
+#include "../packet.hpp"
 #include "../protocol.hpp"
-#include "process.hpp"
+#include "../wire.hpp"
 #include "worker.hpp"
 
 namespace xrun {
 namespace {
-auto build_error_packet(const std::string& cmd, const process::CloseResult& result) -> std::vector<uint8_t> {
-    auto r = std::vector<uint8_t>();
-
-    const auto len = sizeof(WorkerGroupMessage) + sizeof(size_t) + cmd.size() + 1 + 1 + sizeof(size_t) + result.out.size() + sizeof(size_t) + result.err.size();
-    r.reserve(len);
-
-    append_bytes(r, WorkerGroupMessage::ERROR);
-    append_bytes(r, cmd.size());
-    append_bytes(r, cmd.data(), cmd.size());
-    append_bytes(r, static_cast<char>(result.status.reason == process::ExitReason::Exit ? 1 : 0));
-    append_bytes(r, static_cast<char>(result.status.code));
-    append_bytes(r, result.out.size());
-    append_bytes(r, result.out.data(), result.out.size());
-    append_bytes(r, result.err.size());
-    append_bytes(r, result.err.data(), result.err.size());
-
-    return r;
+auto to_captured(const process::Capture& capture, const std::string& log) -> CapturedOutput {
+    return CapturedOutput{capture.get_total(), capture.get_head(), capture.get_tail(), log};
+}
+auto append_error_packet(std::vector<uint8_t>& buffer, const Job& job, const process::CloseResult& result, const std::string (&logs)[2]) -> void {
+    const auto packet = begin_packet(buffer, WorkerGroupMessage::ERROR);
+    wire::append(buffer, ErrorPacket{
+                             .id      = job.id,
+                             .command = job.command,
+                             .exitted = result.status.reason == process::ExitReason::Exit,
+                             .code    = static_cast<uint8_t>(result.status.code),
+                             .out     = to_captured(result.out, logs[0]),
+                             .err     = to_captured(result.err, logs[1]),
+                         });
+    finish_packet(buffer, packet);
 }
 } // namespace
-auto Worker::proc(const EventFileDescriptor& done, SendPacketFunc send_packet) -> void {
-    while(true) {
-        busy.store(false);
-        auto received = channel.read();
-        busy.store(true);
-
-        if(std::holds_alternative<Job>(received)) {
-            const auto job         = std::move(std::get<Job>(received));
-            auto       proc        = process::Process();
-            const auto open_result = proc.open("/usr/bin/zsh", job.command.data(), job.cwd.data(), {false, true, true});
-            if(open_result.message != nullptr) {
-                panic(stderr, "Failed to open process(%d)\n", open_result.error_num);
-            }
-
-            const auto close_result = proc.close();
-            if((close_result.status.reason == process::ExitReason::Exit && close_result.status.code != 0) || close_result.status.reason == process::ExitReason::Signal) {
-                send_packet(build_error_packet(job.command, close_result));
-            }
-            done.notify();
-        } else {
-            const auto message = std::get<Message>(received);
-            switch(message) {
-            case Message::KILL:
-                return;
-                break;
-            }
+auto Worker::get_capture(const int stream) -> process::Capture& {
+    return on_zygote() ? zygote->get_capture(stream) : process.get_capture(stream);
+}
+auto Worker::start(Job job, Launcher& launcher, const process::CaptureOptions& capture) -> void {
+    ASSERT(!is_busy(), "Start job on busy worker")
+    this->job.emplace(std::move(job));
+    started                = steady_ns();
+    process                = process::Process();
+    const auto open_result = launcher.open(process, zygote, this->job->command, this->job->cwd.data(), {false, true, true});
+    if(open_result.message != nullptr) {
+        panic("Failed to open process: ", open_result.message, "(", open_result.error_num, ")");
+    }
+    for(auto stream = 1; stream < 3; stream += 1) {
+        if(!get_capture(stream).start(capture)) {
+            warn("Failed to open log file: ", errno);
         }
     }
 }
-auto Worker::launch(const EventFileDescriptor& done, SendPacketFunc send_packet) -> void {
-    thread = std::thread(&Worker::proc, this, std::ref(done), send_packet);
+auto Worker::finish(std::vector<uint8_t>& buffer, const bool force) -> uint64_t {
+    auto close_result = on_zygote() ? zygote->finish(force) : process.close(force);
+    if((close_result.status.reason == process::ExitReason::Exit && close_result.status.code != 0) || close_result.status.reason == process::ExitReason::Signal) {
+        // keep the full output of failed jobs only
+        const auto prefix  = std::to_string(time(NULL)) + "-" + std::to_string(job->id);
+        const std::string logs[2] = {close_result.out.keep(prefix + ".stdout"), close_result.err.keep(prefix + ".stderr")};
+        append_error_packet(buffer, *job, close_result, logs);
+    }
+    usage         = close_result.usage;
+    const auto id = job->id;
+    job.reset();
+    return id;
 }
-auto Worker::assign_job(Job job) -> void {
-    channel.write(job);
+auto Worker::on_zygote() const -> bool {
+    return zygote.has_value() && zygote->is_running();
 }
-auto Worker::send_message(Message message) -> void {
-    channel.write(message);
+auto Worker::get_fds() const -> std::array<int, 3> {
+    if(on_zygote()) {
+        return {zygote->get_status_fd(), zygote->get_pipe(1), zygote->get_pipe(2)};
+    }
+    return {process.get_pidfd(), process.get_pipe(1), process.get_pipe(2)};
 }
-auto Worker::is_busy() const -> bool {
-    return busy.load();
+auto Worker::poll_exit() -> bool {
+    // pidfd is readable only after the exit
+    return on_zygote() ? zygote->poll_exit() : true;
 }
-Worker::~Worker() {
-    if(thread.joinable()) {
-        thread.join();
-    }
+auto Worker::read_output(const int stream, const size_t limit, std::vector<uint8_t>* const forward) -> bool {
+    return on_zygote() ? zygote->read_output(stream, limit, forward) : process.read_output(stream, limit, forward);
+}
+auto Worker::get_job_id() const -> uint64_t {
+    return job->id;
+}
+auto Worker::get_started() const -> int64_t {
+    return started;
+}
+auto Worker::get_usage() const -> const process::Usage& {
+    return usage;
+}
+auto Worker::is_busy() const -> bool {
+    return job.has_value();
 }
 } // namespace xrun
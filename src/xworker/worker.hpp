@@ -1,38 +1,52 @@
 #pragma once
+#include <array>
+#include <optional>
 #include <string>
-#include <variant>
-#include <functional>
+#include <vector>
 
-#include "../fd.hpp"
-#include "../thread.hpp"
+#include "launcher.hpp"
+#include "process.hpp"
 
 namespace xrun {
 struct Job {
+    uint64_t    id;
     std::string cwd;
     std::string command;
 };
-enum class Message {
-    KILL,
-};
-using WorkerMessage = std::variant<Job, Message>;
 
-using SendPacketFunc = std::function<void(std::vector<uint8_t>&&)>;
+// cwd and command of jobs without the argument
+struct Template {
+    std::string cwd;
+    std::string command;
+};
 
+// a job slot, the process is watched by WorkerGroup
 class Worker {
   private:
-    Channel<WorkerMessage> channel;
-    std::thread            thread;
-    SafeVar<bool>          busy = false;
+    std::optional<Job>             job;
+    process::Process               process;
+    std::optional<process::Zygote> zygote;  // warm shell of this slot
+    int64_t                        started; // timestamp of the last start
+    process::Usage                 usage;   // of the last job
 
-    auto proc(const EventFileDescriptor& done, SendPacketFunc send_packet) -> void;
+    auto on_zygote() const -> bool;
+    auto get_capture(int stream) -> process::Capture&;
 
   public:
-    auto launch(const EventFileDescriptor& done, SendPacketFunc send_packet) -> void;
-    auto assign_job(Job job) -> void;
-    auto send_message(Message message) -> void;
+    auto start(Job job, Launcher& launcher, const process::CaptureOptions& capture) -> void;
+    // appends an error packet to buffer if the job failed, returns the job id
+    auto finish(std::vector<uint8_t>& buffer, bool force = false) -> uint64_t;
+    // fds to watch while the job is running, the first one becomes readable when it exits
+    auto get_fds() const -> std::array<int, 3>;
+    // call this when the first fd became readable, returns true if the job exited
+    auto poll_exit() -> bool;
+    // reads available data of stdout(1) or stderr(2), returns false on eof
+    auto read_output(int stream, size_t limit = SIZE_MAX, std::vector<uint8_t>* forward = nullptr) -> bool;
+    auto get_job_id() const -> uint64_t;
+    auto get_started() const -> int64_t;
+    auto get_usage() const -> const process::Usage&;
     auto is_busy() const -> bool;
 
     Worker() = default;
-    ~Worker();
 };
 } // namespace xrun
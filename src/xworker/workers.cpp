@@ -1,32 +1,23 @@
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <thread>
+
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #include "../byte.hpp"
 #include "../error.hpp"
+#include "../packet.hpp"
 #include "../protocol.hpp"
+#include "../wire.hpp"
 #include "worker.hpp"
 #include "workers.hpp"
 
 namespace xrun {
 namespace {
-auto parse_job_packet(const FileDescriptor& fd) -> Job {
-    do {
-        const auto opt = fd.read_sized();
-        if(!opt.has_value()) {
-            break;
-        }
-        const auto& data = *opt;
-        auto        arr  = ByteReader(data);
-        const auto  cwd  = reinterpret_cast<const char*>(arr.read_until('\0'));
-        const auto  cmd  = reinterpret_cast<const char*>(arr.read_until('\0'));
-        if(cwd == nullptr || cmd == nullptr) {
-            break;
-        }
-        return {cwd, cmd};
-    } while(0);
-    panic("Failed to parse received job");
-    return {};
-}
 auto replace_text(const std::string& str, const std::string& from, const std::string& to, const bool global) -> std::string {
     auto pos = std::string::size_type(0);
     auto r   = str;
@@ -44,7 +35,7 @@ auto replace_text(const std::string& str, const std::string& from, const std::st
         pos = p + 1;
     }
 }
-auto replace_job_text(const std::vector<ReplaceString>& replace, Job job) -> Job {
+auto replace_job_text(const std::vector<ReplaceString>& replace, Template job) -> Template {
     // /home/mojyack/working/ /home/mojyack/remote/01-567/working
     for(const auto& r : replace) {
         if(!r.command_only) {
@@ -56,17 +47,203 @@ auto replace_job_text(const std::vector<ReplaceString>& replace, Job job) -> Job
     }
     return job;
 }
+// templates are replaced once when registered, arguments are part of the command
+auto replace_argument_text(const std::vector<ReplaceString>& replace, std::string arg) -> std::string {
+    for(const auto& r : replace) {
+        if(!r.cwd_only) {
+            arg = replace_text(arg, r.from, r.to, r.global);
+        }
+    }
+    return arg;
+}
+auto parse_job_packet(ByteReader& packet, std::vector<Template>& templates, const std::vector<ReplaceString>& replace) -> std::vector<Job> {
+    auto jobs = std::vector<Job>();
+    while(!packet.is_end()) {
+        const auto entry = wire::read<JobEntry>(packet);
+        if(!entry.has_value() || (entry->slot & ~TEMPLATE_DEFINED) >= MAX_TEMPLATES) {
+            panic("Failed to parse received job");
+        }
+        auto& t = templates[entry->slot & ~TEMPLATE_DEFINED];
+        if(entry->slot & TEMPLATE_DEFINED) {
+            const auto tmpl = wire::read<JobTemplate>(packet);
+            if(!tmpl.has_value()) {
+                panic("Failed to parse received job");
+            }
+            t = replace_job_text(replace, Template{tmpl->cwd, tmpl->command});
+        }
+        const auto arg = reinterpret_cast<const char*>(packet.read_until('\0'));
+        if(arg == nullptr) {
+            panic("Failed to parse received job");
+        }
+        jobs.emplace_back(Job{entry->id, t.cwd, t.command + ' ' + replace_argument_text(replace, arg)});
+    }
+    return jobs;
+}
+auto append_ids_packet(std::vector<uint8_t>& buffer, const WorkerGroupMessage type, const std::vector<uint64_t>& ids) -> void {
+    const auto packet = begin_packet(buffer, type);
+    wire::append(buffer, ids);
+    finish_packet(buffer, packet);
+}
+auto append_done_packet(std::vector<uint8_t>& buffer, const std::vector<Done>& jobs) -> void {
+    auto entries = std::vector<DoneEntry>();
+    entries.reserve(jobs.size());
+    for(const auto& job : jobs) {
+        const auto& u = job.usage;
+        entries.emplace_back(DoneEntry{job.id, job.slot, job.started, job.finished, u.user_us, u.system_us, u.max_rss_kb,
+                                       u.minor_faults, u.major_faults, u.voluntary_switches, u.involuntary_switches});
+    }
+    const auto packet = begin_packet(buffer, WorkerGroupMessage::DONE);
+    wire::append(buffer, entries);
+    finish_packet(buffer, packet);
+}
 } // namespace
-auto WorkerGroup::send_packet(std::vector<uint8_t>&& packet) -> void {
-    const auto lock = packets.get_lock();
-    packets->emplace_back(packet);
-    packets_update.notify();
+auto WorkerGroup::add_epoll_handle(const int fd, const uint64_t data) -> void {
+    auto evset = epoll_event{.events = EPOLLIN, .data = {.u64 = data}};
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evset) < 0) {
+        panic("epoll_ctl() failed: ", errno);
+    }
+}
+auto WorkerGroup::flush_connection() -> bool {
+    const auto fd = static_cast<int>(connection->get_fd());
+    if(!writer.flush(connection->get_fd())) {
+        return false;
+    }
+    // watch EPOLLOUT only while something is left to send
+    if(const auto pending = writer.is_pending(); pending != watching_output) {
+        auto evset = epoll_event{.events = EPOLLIN | (pending ? EPOLLOUT : 0u), .data = {.u64 = static_cast<uint64_t>(fd)}};
+        if(epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &evset) < 0) {
+            panic("epoll_ctl() failed: ", errno);
+        }
+        watching_output = pending;
+    }
+    return true;
+}
+auto WorkerGroup::append_capacity_packet() -> void {
+    auto&      buffer = writer.get_buffer();
+    const auto packet = begin_packet(buffer, WorkerGroupMessage::CAPACITY);
+    wire::append(buffer, admission->get_capacity());
+    finish_packet(buffer, packet);
+}
+auto WorkerGroup::update_admission() -> void {
+    auto expirations = uint64_t();
+    read(admission_timer, &expirations, sizeof(expirations));
+    if(!admission->update()) {
+        return;
+    }
+    print("Capacity ", admission->get_capacity(), "/", workers.size(), " (", admission->get_reason(), ")");
+    if(connection.has_value()) {
+        append_capacity_packet();
+    }
+}
+auto WorkerGroup::start_jobs() -> void {
+    auto running = std::count_if(workers.begin(), workers.end(), [](const Worker& w) { return w.is_busy(); });
+    for(auto i = size_t(0); i < workers.size() && !backlog.empty(); i += 1) {
+        auto& w = workers[i];
+        if(w.is_busy()) {
+            continue;
+        }
+        if(size_t(running) >= admission->get_capacity()) {
+            // running jobs are not stopped when the capacity shrinks
+            break;
+        }
+        running += 1;
+        w.start(std::move(backlog.front()), *launcher, capture);
+        backlog.pop_front();
+
+        // tag the process fds with the slot, see handle_process_event()
+        // output is read after the server gives credit if paused
+        const auto tag = (i + 1) << 32;
+        const auto fds = w.get_fds();
+        for(auto j = 0; j < (output_paused ? 1 : 3); j += 1) {
+            add_epoll_handle(fds[j], tag | fds[j]);
+        }
+    }
+}
+auto WorkerGroup::finish_job(Worker& worker, const bool force) -> void {
+    const auto finished_at = steady_ns();
+    for(const auto fd : worker.get_fds()) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    if(credit.has_value()) {
+        // the rest is bounded by the pipe capacity, send it regardless of the credit
+        for(auto stream = 1; stream < 3; stream += 1) {
+            read_job_output(worker, stream, true);
+        }
+    }
+    const auto slot = static_cast<uint32_t>(&worker - workers.data());
+    const auto id   = worker.finish(writer.get_buffer(), force);
+    finished.emplace_back(Done{id, slot, worker.get_started(), finished_at, worker.get_usage()});
+}
+auto WorkerGroup::read_job_output(Worker& worker, const int stream, const bool unlimited) -> bool {
+    if(!credit.has_value()) {
+        return worker.read_output(stream);
+    }
+
+    // read directly into an output packet
+    auto&      buffer = writer.get_buffer();
+    const auto packet = begin_packet(buffer, WorkerGroupMessage::OUTPUT);
+    wire::append(buffer, OutputHeader{worker.get_job_id(), static_cast<uint8_t>(stream)});
+    const auto data   = buffer.size();
+
+    const auto limit = unlimited ? SIZE_MAX : static_cast<size_t>(std::max(*credit, int64_t(0)));
+    const auto open  = worker.read_output(stream, limit, &buffer);
+    const auto len   = buffer.size() - data;
+    if(len == 0) {
+        buffer.resize(packet);
+    } else {
+        finish_packet(buffer, packet);
+        *credit -= len;
+    }
+    if(*credit <= 0) {
+        pause_output(true);
+    }
+    return open;
+}
+auto WorkerGroup::pause_output(const bool pause) -> void {
+    if(pause == output_paused) {
+        return;
+    }
+    output_paused = pause;
+    // processes block on full pipes while the pipes are not read
+    for(auto i = size_t(0); i < workers.size(); i += 1) {
+        if(!workers[i].is_busy()) {
+            continue;
+        }
+        const auto fds = workers[i].get_fds();
+        for(auto stream = 1; stream < 3; stream += 1) {
+            if(pause) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fds[stream], NULL);
+            } else {
+                // may be already removed on eof, then it is removed again by the next event
+                auto evset = epoll_event{.events = EPOLLIN, .data = {.u64 = (i + 1) << 32 | fds[stream]}};
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fds[stream], &evset);
+            }
+        }
+    }
+}
+auto WorkerGroup::handle_process_event(Worker& worker, const int fd) -> void {
+    const auto fds = worker.get_fds();
+    if(fd == fds[0]) {
+        if(worker.poll_exit()) {
+            finish_job(worker);
+        }
+        return;
+    }
+    for(auto stream = 1; stream < 3; stream += 1) {
+        if(fd == fds[stream] && !read_job_output(worker, stream)) {
+            // eof, the process exit is reported by pidfd
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+    }
 }
 auto WorkerGroup::run(const Args& args) -> void {
+    // writing to a closed zygote or server should not kill us
+    signal(SIGPIPE, SIG_IGN);
+
     // open socket
     auto sock = FileDescriptor(-1);
     auto port = uint16_t();
-    if(auto opt = args.local ? open_local_server_socket("\0xrun-local-worker") : open_tcp_server_socket({1024, 1034}, &port); opt.message != nullptr) {
+    if(auto opt = args.local ? open_local_server_socket(local_worker_socket_name(args.name).data()) : open_tcp_server_socket({1024, 1034}, &port); opt.message != nullptr) {
         panic("Failed to open socket: ", opt.message);
     } else {
         if(args.local) {
@@ -82,124 +259,203 @@ auto WorkerGroup::run(const Args& args) -> void {
     }
 
     // setup workers
-    const auto workers_count = args.jobs.has_value() ? *args.jobs : std::thread::hardware_concurrency();
-    auto       workers       = std::vector<Worker>(workers_count);
-    const auto job_done      = EventFileDescriptor();
-    for(auto& w : workers) {
-        w.launch(job_done, std::bind(&WorkerGroup::send_packet, this, std::placeholders::_1));
+    launcher.emplace(args.launcher, args.shell, args.zygote);
+    capture.limit   = args.output_limit;
+    capture.log_dir = args.log_dir;
+    if(capture.log_dir != nullptr) {
+        if(const auto fd = FileDescriptor(open(capture.log_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0644)); fd < 0) {
+            panic("Cannot create log files in ", capture.log_dir, ": ", errno);
+        }
     }
+    const auto workers_count = args.jobs.has_value() ? *args.jobs : std::thread::hardware_concurrency();
+    workers                  = std::vector<Worker>(workers_count);
+    admission.emplace(args.admission, workers_count);
 
     // setup epoll
-    const auto epfd = FileDescriptor(epoll_create(1));
+    epfd = FileDescriptor(epoll_create(1));
     if(epfd < 0) {
         panic("epoll_create() failed: ", errno);
     }
-    auto evset   = epoll_event();
-    evset.events = EPOLLIN;
-    {
-        const int fds[] = {fileno(stdin), sock, job_done, packets_update};
-        for(size_t i = 0; i < 4; i += 1) {
-            evset.data.fd = fds[i];
-            if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &evset) < 0) {
-                panic("epoll_ctl() failed: ", errno);
-            }
+    add_epoll_handle(fileno(stdin), fileno(stdin));
+    add_epoll_handle(sock, sock);
+    if(admission->is_enabled()) {
+        // PSI avg10 is smoothed enough to sample every second
+        admission_timer = FileDescriptor(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+        const auto spec = itimerspec{.it_interval = {1, 0}, .it_value = {1, 0}};
+        if(admission_timer < 0 || timerfd_settime(admission_timer, 0, &spec, nullptr) < 0) {
+            panic("Failed to create timer: ", errno);
         }
+        add_epoll_handle(admission_timer, admission_timer);
     }
 
     // main loop
-    auto input = std::string();
-    auto ev    = epoll_event();
-    while(true) {
-        if(epoll_wait(epfd, &ev, 1, -1) < 0) {
+    constexpr auto MAX_EVENTS = 64;
+    auto           events     = std::array<epoll_event, MAX_EVENTS>();
+    auto           input      = std::string();
+    auto           running    = true;
+    while(running) {
+        const auto count = epoll_wait(epfd, events.data(), MAX_EVENTS, -1);
+        if(count < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
             panic("epoll_wait() failed: ", errno);
         }
-        if(ev.data.fd == fileno(stdin)) {
-            if(ev.events & EPOLLHUP || ev.events & EPOLLERR) {
-                panic("stdin closed");
-            } else if(ev.events & EPOLLIN) {
-                constexpr auto BUF_LEN = 64;
-                char           buf[BUF_LEN + 1];
-                buf[BUF_LEN] = '\0';
-                if(read(fileno(stdin), buf, BUF_LEN) < 0) {
-                    panic("read() failed.");
-                }
-                if(const auto c = std::strchr(buf, '\n'); c != NULL) {
-                    *c = '\0';
-                    input += buf;
-                    if(input == "q") {
-                        break;
+        for(auto i = 0; i < count && running; i += 1) {
+            const auto& ev   = events[i];
+            const auto  slot = ev.data.u64 >> 32;
+            const auto  fd   = static_cast<int>(ev.data.u64 & 0xFFFFFFFF);
+            if(slot != 0) {
+                handle_process_event(workers[slot - 1], fd);
+            } else if(fd == fileno(stdin)) {
+                if(ev.events & EPOLLHUP || ev.events & EPOLLERR) {
+                    panic("stdin closed");
+                } else if(ev.events & EPOLLIN) {
+                    constexpr auto BUF_LEN = 64;
+                    char           buf[BUF_LEN + 1];
+                    buf[BUF_LEN] = '\0';
+                    if(read(fileno(stdin), buf, BUF_LEN) < 0) {
+                        panic("read() failed.");
                     }
-                    input.clear();
+                    if(const auto c = std::strchr(buf, '\n'); c != NULL) {
+                        *c = '\0';
+                        input += buf;
+                        if(input == "q") {
+                            running = false;
+                        }
+                        input.clear();
+                    } else {
+                        input += buf;
+                    }
+                }
+            } else if(fd == admission_timer) {
+                update_admission();
+            } else if(fd == sock) {
+                auto c = Connection::connect(sock);
+                if(!c.has_value()) {
+                    panic("Failet to accept xserver");
+                }
+                const auto address = c->get_address();
+                if(address == 0) {
+                    print("Connected to local server");
                 } else {
-                    input += buf;
+                    print("Connected to remote server ", inet_ntoa({address}));
                 }
-            }
-        } else if(ev.data.fd == sock) {
-            auto c = Connection::connect(sock);
-            if(!c.has_value()) {
-                panic("Failet to accept xserver");
-            }
-            const auto address = c->get_address();
-            if(address == 0) {
-                print("Connected to local server");
-            } else {
-                print("Connected to remote server ", inet_ntoa({address}));
-            }
-            connection.emplace(std::move(*c));
-            evset.data.fd = connection->get_fd();
-            epoll_ctl(epfd, EPOLL_CTL_ADD, evset.data.fd, &evset);
-        } else if(connection.has_value() && ev.data.fd == connection->get_fd()) {
-            if(ev.events & EPOLLHUP || ev.events & EPOLLERR) {
-                print("Connection closed");
-                epoll_ctl(epfd, EPOLL_CTL_DEL, ev.data.fd, NULL);
-                connection.reset();
-            } else if(ev.events & EPOLLIN) {
-                const auto& fd   = connection->get_fd();
-                const auto  type = fd.read<WorkerGroupMessage>();
-                if(!type.has_value()) {
-                    panic("Failed to read message from xserver");
+                // a slow server must not block the loop, which also reads the jobs' output
+                if(!c->get_fd().set_nonblocking()) {
+                    panic("fcntl() failed: ", errno);
+                }
+                connection.emplace(std::move(*c));
+                reader          = PacketReader();
+                writer          = PacketWriter();
+                watching_output = false;
+                templates.assign(MAX_TEMPLATES, Template());
+                add_epoll_handle(connection->get_fd(), connection->get_fd());
+            } else if(connection.has_value() && fd == connection->get_fd()) {
+                auto closed = ev.events & EPOLLHUP || ev.events & EPOLLERR;
+                if(!closed && ev.events & EPOLLIN) {
+                    closed = !reader.fill(connection->get_fd());
+                    if(reader.is_oversized()) {
+                        warn("xserver sent an oversized packet");
+                    }
                 }
-                switch(*type) {
-                case WorkerGroupMessage::WORKERS:
-                    fd.write(static_cast<uint32_t>(workers_count));
-                    break;
-                case WorkerGroupMessage::JOB: {
-                    auto assigned = false;
-                    for(auto& w : workers) {
-                        if(!w.is_busy()) {
-                            w.assign_job(replace_job_text(args.replace, parse_job_packet(fd)));
-                            assigned = true;
+                while(!closed) {
+                    auto packet = reader.next();
+                    if(!packet.has_value()) {
+                        break;
+                    }
+                    const auto type = wire::read<WorkerGroupMessage>(*packet);
+                    if(!type.has_value()) {
+                        panic("Failed to read message from xserver");
+                    }
+                    switch(*type) {
+                    case WorkerGroupMessage::WORKERS: {
+                        const auto version = packet->read(sizeof(uint32_t));
+                        if(version == nullptr) {
+                            panic("Failed to read message from xserver");
+                        }
+                        // tell the version in any case, so that xserver can report the mismatch
+                        const auto matched = wire::read_fixed<uint32_t>(version) == PROTOCOL_VERSION;
+                        auto&      buffer  = writer.get_buffer();
+                        const auto packet  = begin_packet(buffer, WorkerGroupMessage::WORKERS);
+                        wire::append_fixed(buffer, PROTOCOL_VERSION);
+                        if(matched) {
+                            wire::append(buffer, WorkersReply{static_cast<uint32_t>(workers_count), steady_ns()});
+                        }
+                        finish_packet(buffer, packet);
+                        if(!matched) {
+                            warn("Protocol version of xserver is ", wire::read_fixed<uint32_t>(version), ", expected ", PROTOCOL_VERSION);
                             break;
                         }
+                        if(admission->get_capacity() != workers_count) {
+                            append_capacity_packet();
+                        }
+                    } break;
+                    case WorkerGroupMessage::JOB:
+                        for(auto& job : parse_job_packet(*packet, templates, args.replace)) {
+                            backlog.emplace_back(std::move(job));
+                        }
+                        break;
+                    case WorkerGroupMessage::CREDIT: {
+                        const auto bytes = wire::read<uint64_t>(*packet);
+                        if(!bytes.has_value()) {
+                            panic("Failed to read message from xserver");
+                        }
+                        credit = credit.value_or(0) + *bytes;
+                        if(*credit > 0) {
+                            pause_output(false);
+                        }
+                    } break;
+                    case WorkerGroupMessage::REVOKE: {
+                        const auto count = wire::read<uint32_t>(*packet);
+                        if(!count.has_value()) {
+                            panic("Failed to read message from xserver");
+                        }
+                        // give back the most recently received jobs which are not started yet
+                        auto ids = std::vector<uint64_t>();
+                        while(ids.size() < *count && !backlog.empty()) {
+                            ids.emplace_back(backlog.back().id);
+                            backlog.pop_back();
+                        }
+                        append_ids_packet(writer.get_buffer(), WorkerGroupMessage::REVOKED, ids);
+                    } break;
+                    default:
+                        panic("Received an invalid message ", static_cast<int>(*type));
+                        break;
                     }
-                    ASSERT(assigned, "Could not assign received job")
-                } break;
-                default:
-                    panic("Received an invalid message ", static_cast<int>(*type));
-                    break;
-                }
-            }
-        } else if(ev.data.fd == job_done) {
-            auto count = job_done.consume();
-            if(connection.has_value()) {
-                while(count > 0) {
-                    connection->get_fd().write(WorkerGroupMessage::DONE);
-                    count -= 1;
                 }
-            }
-        } else if(ev.data.fd == packets_update) {
-            packets_update.consume();
-            if(connection.has_value()) {
-                auto lock = packets.get_lock();
-                for(const auto& p : *packets) {
-                    connection->get_fd().write(p.data(), p.size());
+                if(closed) {
+                    print("Connection closed");
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                    connection.reset();
+                    backlog.clear();
+                    credit.reset();
+                    pause_output(false);
                 }
             }
         }
+
+        // report completions of this round at once, then refill the slots
+        if(!finished.empty()) {
+            append_done_packet(writer.get_buffer(), finished);
+            finished.clear();
+        }
+        start_jobs();
+        if(connection.has_value() && !flush_connection()) {
+            print("Connection closed");
+            epoll_ctl(epfd, EPOLL_CTL_DEL, connection->get_fd(), NULL);
+            connection.reset();
+            backlog.clear();
+            credit.reset();
+            pause_output(false);
+        }
     }
 
+    // wait for running jobs
     for(auto& w : workers) {
-        w.send_message(Message::KILL);
+        if(w.is_busy()) {
+            finish_job(w);
+        }
     }
 }
 } // namespace xrun
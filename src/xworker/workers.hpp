@@ -1,19 +1,50 @@
 #pragma once
 #include <cstdint>
+#include <deque>
 #include <vector>
 
+#include "../packet.hpp"
 #include "../socket.hpp"
-#include "../thread.hpp"
 #include "arg.hpp"
+#include "worker.hpp"
 
 namespace xrun {
+// a finished job, reported with the next DONE
+struct Done {
+    uint64_t       id;
+    uint32_t       slot;
+    int64_t        started;
+    int64_t        finished;
+    process::Usage usage;
+};
+
 class WorkerGroup {
   private:
-    std::optional<Connection>                  connection;
-    SafeVar<std::vector<std::vector<uint8_t>>> packets;
-    EventFileDescriptor                        packets_update;
+    std::optional<Connection> connection;
+    PacketReader              reader;
+    PacketWriter              writer;
+    FileDescriptor            epfd;
+    std::optional<Launcher>   launcher;
+    std::optional<Admission>  admission;
+    FileDescriptor            admission_timer;
+    process::CaptureOptions   capture;
+    std::vector<Worker>       workers;
+    std::deque<Job>           backlog;   // jobs prefetched by the server
+    std::vector<Template>     templates; // commands registered by the server, with the replacements applied
+    std::vector<Done>         finished;
+    std::optional<int64_t>    credit; // bytes of output allowed to stream, nullopt if not streaming
+    bool                      output_paused   = false;
+    bool                      watching_output = false; // EPOLLOUT of the connection
 
-    auto send_packet(std::vector<uint8_t>&& packet) -> void;
+    auto add_epoll_handle(int fd, uint64_t data) -> void;
+    auto flush_connection() -> bool;
+    auto append_capacity_packet() -> void;
+    auto update_admission() -> void;
+    auto start_jobs() -> void;
+    auto finish_job(Worker& worker, bool force = false) -> void;
+    auto read_job_output(Worker& worker, int stream, bool unlimited = false) -> bool;
+    auto pause_output(bool pause) -> void;
+    auto handle_process_event(Worker& worker, int fd) -> void;
 
   public:
     auto run(const Args& args) -> void;
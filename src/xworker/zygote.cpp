@@ -0,0 +1,291 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <optional>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <wait.h>
+
+#include "zygote.hpp"
+
+namespace process {
+namespace {
+auto write_all(const int fd, const std::string& data) -> bool {
+    auto sent = size_t(0);
+    while(sent < data.size()) {
+        const auto n = write(fd, data.data() + sent, data.size() - sent);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+auto wait_readable(const int fd) -> void {
+    auto pfd = pollfd{.fd = fd, .events = POLLIN};
+    while(poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+    }
+}
+// cumulative usage of the waited children of a process, from /proc/PID/stat
+auto read_children_usage(const pid_t pid) -> Usage {
+    auto       usage = Usage();
+    const auto path  = "/proc/" + std::to_string(pid) + "/stat";
+    const auto fd    = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return usage;
+    }
+    char       buf[1024];
+    const auto n = read(fd, buf, sizeof(buf) - 1);
+    ::close(fd);
+    if(n <= 0) {
+        return usage;
+    }
+    buf[n] = '\0';
+
+    // the command name may contain anything, fields after it are separated by spaces
+    // cminflt, cmajflt, cutime and cstime are the 11th, 13th, 16th and 17th field
+    const auto name_end = strrchr(buf, ')');
+    if(name_end == nullptr) {
+        return usage;
+    }
+    long long fields[15];
+    auto      p = name_end + 2;
+    // fields[i] is the (i + 4)th field, the state is skipped
+    for(auto i = 0; i < 15; i += 1) {
+        p = strchr(p, ' ');
+        if(p == nullptr) {
+            return usage;
+        }
+        fields[i] = strtoll(p + 1, &p, 10);
+    }
+    static const auto ticks = sysconf(_SC_CLK_TCK);
+    usage.minor_faults      = fields[7];
+    usage.major_faults      = fields[9];
+    usage.user_us           = fields[12] * 1000000 / ticks;
+    usage.system_us         = fields[13] * 1000000 / ticks;
+    return usage;
+}
+auto to_exit_status(const int status) -> ExitStatus {
+    const bool exitted = WIFEXITED(status);
+    return {exitted ? ExitReason::Exit : ExitReason::Signal, exitted ? WEXITSTATUS(status) : WTERMSIG(status)};
+}
+// the status pipe carries
+//     the pid of the subshell
+//     "x" and the exit code, if the subshell exited by itself
+//     the exit code of the subshell as the shell reports it, 128 + signal number if killed
+// returns nullopt until the last line arrives
+auto parse_status(const std::string& buffer) -> std::optional<ExitStatus> {
+    const auto first = buffer.find('\n');
+    if(first == std::string::npos) {
+        return std::nullopt;
+    }
+    auto exited = std::optional<int>();
+    auto begin  = first + 1;
+    if(begin < buffer.size() && buffer[begin] == 'x') {
+        const auto end = buffer.find('\n', begin);
+        if(end == std::string::npos) {
+            return std::nullopt;
+        }
+        exited = std::stoi(buffer.substr(begin + 1, end - begin - 1));
+        begin  = end + 1;
+    }
+    const auto end = buffer.find('\n', begin);
+    if(end == std::string::npos) {
+        return std::nullopt;
+    }
+    if(exited.has_value()) {
+        // exact, also for codes above 128
+        return ExitStatus{ExitReason::Exit, *exited};
+    }
+    // the exit trap did not run, so the subshell was killed
+    // a command which replaced the subshell by exec looks the same, its code is taken as a signal above 128
+    const auto code = std::stoi(buffer.substr(begin, end - begin));
+    return code > 128 ? ExitStatus{ExitReason::Signal, code - 128} : ExitStatus{ExitReason::Exit, code};
+}
+} // namespace
+
+// the subshell runs in foreground, background jobs of a non-interactive shell ignore SIGINT and SIGQUIT
+// it reports its own pid before the exit code, read is a builtin so /proc/self is the subshell
+// stdin and the status pipe are not passed to the command, the exit trap reopens the pipe of the shell
+// see parse_status() for the reported lines
+const char* const Zygote::script = R"(while IFS= read -r xrun_cwd && IFS= read -r xrun_command; do
+    (
+        read -r xrun_pid xrun_stat </proc/self/stat
+        echo "$xrun_pid" >&3
+        trap 'echo "x$?" >/proc/$$/fd/3' EXIT
+        exec 3>&-
+        { [ -z "$xrun_cwd" ] || cd -- "$xrun_cwd"; } && eval "$xrun_command"
+    ) </dev/null
+    echo $? >&3
+done)";
+
+auto Zygote::read_status() -> bool {
+    while(true) {
+        char       buf[64];
+        const auto n = read(status, buf, sizeof(buf));
+        if(n > 0) {
+            status_buffer.append(buf, n);
+            continue;
+        }
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+auto Zygote::close_shell() -> ExitStatus {
+    for(auto i = 0; i < 3; i += 1) {
+        if(pipes[i] != -1) {
+            ::close(pipes[i]);
+            pipes[i] = -1;
+        }
+    }
+    ::close(input);
+    ::close(status);
+    input  = -1;
+    status = -1;
+
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    pid = -1;
+    return to_exit_status(wstatus);
+}
+auto Zygote::open(const char* const path, const char* const* argv, const char* const* envp) -> OpenResult {
+    // 0: commands, 1: stdout, 2: stderr, 3: status
+    int fds[4][2];
+    for(auto i = 0; i < 4; i += 1) {
+        if(pipe2(fds[i], O_CLOEXEC) == 0) {
+            continue;
+        }
+        const auto error = errno;
+        for(auto j = 0; j < i; j += 1) {
+            ::close(fds[j][0]);
+            ::close(fds[j][1]);
+        }
+        return {.message = "Failed to create pipe", .error_num = error};
+    }
+    const auto pid = vfork();
+    if(pid < 0) {
+        const auto error = errno;
+        for(auto i = 0; i < 4; i += 1) {
+            ::close(fds[i][0]);
+            ::close(fds[i][1]);
+        }
+        return {.message = "Failed to fork process", .error_num = error};
+    } else if(pid != 0) {
+        this->pid = pid;
+        for(auto i = 0; i < 4; i += 1) {
+            // keep the parent side
+            const auto fd = fds[i][i == 0 ? 1 : 0];
+            ::close(fds[i][i == 0 ? 0 : 1]);
+            if(i != 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            }
+            (i == 0 ? input : i == 3 ? status : pipes[i]) = fd;
+        }
+        return {};
+    } else {
+        for(auto i = 0; i < 4; i += 1) {
+            const auto fd = fds[i][i == 0 ? 0 : 1];
+            if(fd == i) {
+                // dup2() does nothing in this case, so clear close-on-exec by hand
+                fcntl(fd, F_SETFD, 0);
+            } else {
+                dup2(fd, i);
+            }
+        }
+        // xworker ignores SIGPIPE, and a shell cannot restore a signal ignored at its start
+        signal(SIGPIPE, SIG_DFL);
+        execve(path, const_cast<char* const*>(argv), envp != nullptr ? const_cast<char* const*>(envp) : environ);
+        _exit(127);
+    }
+}
+auto Zygote::run(const char* const working_dir, const std::string& command) -> OpenResult {
+    if(!write_all(input, std::string(working_dir != nullptr ? working_dir : "") + "\n" + command + "\n")) {
+        const auto error = errno;
+        close_shell();
+        return {.message = "Failed to send command to zygote", .error_num = error};
+    }
+    base    = read_children_usage(pid);
+    running = true;
+    return {};
+}
+auto Zygote::read_output(const int stream, const size_t limit, std::vector<uint8_t>* const forward) -> bool {
+    const auto fd = pipes[stream];
+    if(fd == -1) {
+        return false;
+    }
+    return outputs[stream - 1].read(fd, limit, forward);
+}
+auto Zygote::poll_exit() -> bool {
+    if(!read_status()) {
+        // the shell died
+        return true;
+    }
+    const auto first = status_buffer.find('\n');
+    if(first == std::string::npos) {
+        return false;
+    }
+    if(job_pid == -1) {
+        job_pid = std::stoi(status_buffer.substr(0, first));
+    }
+    return parse_status(status_buffer).has_value();
+}
+auto Zygote::finish(const bool force) -> CloseResult {
+    if(force) {
+        while(job_pid == -1 && !poll_exit()) {
+            wait_readable(status);
+        }
+        if(job_pid != -1 && kill(job_pid, SIGKILL) == -1) {
+            return {.message = "Failed to kill process"};
+        }
+    }
+    while(!poll_exit()) {
+        wait_readable(status);
+    }
+
+    // take what is left in the pipes, descendants of the command may still write to them though
+    for(auto i = 1; i < 3; i += 1) {
+        read_output(i);
+    }
+
+    auto result = CloseResult{.out = std::move(outputs[0]), .err = std::move(outputs[1])};
+    outputs[0]  = Capture();
+    outputs[1]  = Capture();
+    if(const auto status = parse_status(status_buffer); status.has_value()) {
+        result.status = *status;
+        // the shell has waited the command before reporting the code
+        const auto now            = read_children_usage(pid);
+        result.usage.user_us      = now.user_us - base.user_us;
+        result.usage.system_us    = now.system_us - base.system_us;
+        result.usage.minor_faults = now.minor_faults - base.minor_faults;
+        result.usage.major_faults = now.major_faults - base.major_faults;
+    } else {
+        result.status = close_shell();
+    }
+    status_buffer.clear();
+    job_pid = -1;
+    running = false;
+    return result;
+}
+auto Zygote::is_alive() const -> bool {
+    return pid != -1;
+}
+auto Zygote::is_running() const -> bool {
+    return running;
+}
+auto Zygote::get_status_fd() const -> int {
+    return status;
+}
+auto Zygote::get_pipe(const int stream) const -> int {
+    return pipes[stream];
+}
+auto Zygote::get_capture(const int stream) -> Capture& {
+    return outputs[stream - 1];
+}
+} // namespace process
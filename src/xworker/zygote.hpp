@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+
+#include <unistd.h>
+
+#include "process.hpp"
+
+namespace process {
+// a warm shell which forks a subshell for each command
+// output of the commands comes through the same pipes, so a command must not leave descendants writing to them
+// the shell reaps the commands, so only cpu time and page faults are known from its children counters
+class Zygote {
+  private:
+    pid_t       pid      = -1;
+    int         input    = -1; // commands to the shell
+    int         status   = -1; // pid and exit code of each command from the shell
+    int         pipes[3] = {-1, -1, -1};
+    pid_t       job_pid  = -1;
+    bool        running  = false;
+    std::string status_buffer;
+    Capture     outputs[2];
+    Usage       base; // children counters of the shell when the command started
+
+    auto read_status() -> bool;
+    auto close_shell() -> ExitStatus;
+
+  public:
+    // the shell script to be passed with "-c"
+    static const char* const script;
+
+    auto open(const char* path, const char* const* argv, const char* const* envp) -> OpenResult;
+    // commands containing a newline can not be sent
+    auto run(const char* working_dir, const std::string& command) -> OpenResult;
+    // reads available data of stdout(1) or stderr(2) without blocking, returns false on eof
+    // see Capture::read() for limit and forward
+    auto read_output(int stream, size_t limit = SIZE_MAX, std::vector<uint8_t>* forward = nullptr) -> bool;
+    // call this when the status fd became readable, returns true if the command exited
+    auto poll_exit() -> bool;
+    // waits for the command, the shell is kept alive for the next one
+    auto finish(bool force = false) -> CloseResult;
+    auto is_alive() const -> bool;
+    auto is_running() const -> bool;
+    auto get_status_fd() const -> int;
+    auto get_pipe(int stream) const -> int;
+    auto get_capture(int stream) -> Capture&;
+
+    Zygote() = default;
+};
+} // namespace process